@@ -0,0 +1,44 @@
+#include "aot.h"
+#include <cstring>
+
+const unsigned int AOT_START_ADDRESS = 0x200;
+
+AotRuntime::AotRuntime(AotProgram program) : program(program), active(4096, nullptr)
+{
+    for (size_t i = 0; i < program.block_count; i++)
+    {
+        AotBlock const &block = program.blocks[i];
+        for (uint32_t address = block.start; address < block.end && address < 4096; address++)
+        {
+            covered[address] = true;
+        }
+    }
+}
+
+void AotRuntime::Validate(uint8_t const *memory, uint16_t address, uint16_t length)
+{
+    bool touched = false;
+    for (uint32_t i = 0; i < length && !touched; i++)
+    {
+        touched = covered[(address + i) & 0x0FFFu];
+    }
+    if (!touched)
+    {
+        return;
+    }
+
+    const uint32_t first = address;
+    const uint32_t last = address + length;
+    for (size_t i = 0; i < program.block_count; i++)
+    {
+        AotBlock const &block = program.blocks[i];
+        if (block.end <= first || block.start >= last)
+        {
+            continue;
+        }
+
+        bool matches = block.start >= AOT_START_ADDRESS && block.end <= AOT_START_ADDRESS + program.rom_size &&
+                       memcmp(memory + block.start, program.rom + (block.start - AOT_START_ADDRESS), block.end - block.start) == 0;
+        active[block.start] = matches ? &block : nullptr;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// where the state a statically recompiled block touches sits in the Chip8 it runs on, as
+// byte offsets from the pointer each block is called with (like JitLayout), so a Chip8 can be
+// moved after SetAotProgram. built once by Chip8::SetAotProgram, generated code never sees
+// the Chip8 class itself
+struct AotLayout
+{
+    int32_t registers;
+    int32_t index;
+    int32_t pc;
+    int32_t delay_timer;
+    void (*fallback)(void *chip8, uint32_t opcode); // runs one instruction, pc already past it
+};
+
+typedef void (*AotCode)(AotLayout const &layout, void *chip8);
+
+struct AotBlock
+{
+    uint16_t start;
+    uint16_t end;    // one past the last byte
+    uint32_t length; // instructions
+    AotCode code;
+};
+
+// what chip8-aot generates for a ROM: the ROM bytes it was compiled from and one function
+// per reachable basic block
+struct AotProgram
+{
+    uint8_t const *rom;
+    size_t rom_size;
+    AotBlock const *blocks;
+    size_t block_count;
+};
+
+// finds the compiled block for a pc. a block is only used while memory still holds the
+// bytes it was compiled from, so code written at runtime goes back to the interpreter
+class AotRuntime
+{
+public:
+    explicit AotRuntime(AotProgram program);
+
+    AotBlock const *Get(uint16_t pc) const { return active[pc & 0x0FFFu]; }
+
+    // re-checks every block overlapping memory[address, address + length)
+    void Validate(uint8_t const *memory, uint16_t address, uint16_t length);
+
+private:
+    AotProgram program; // only pointers into the generated tables, cheap to keep a copy
+    std::vector<AotBlock const *> active;
+    std::bitset<4096> covered{};
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "decode.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+// statically recompiles a ROM into C++: walks the code reachable from 0x200 and writes one
+// function per basic block, plus the AotProgram table that Chip8::SetAotProgram takes
+
+const unsigned int START_ADDRESS = 0x200;
+const size_t MAX_BLOCK_LENGTH = 64;
+
+struct BlockInfo
+{
+    uint16_t end;
+    uint32_t length;
+    std::string body;
+};
+
+static std::string Hex(unsigned int value, int digits)
+{
+    char text[16];
+    snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+
+static std::string Reg(uint8_t r)
+{
+    return "V[" + Hex(r, 1) + "]";
+}
+
+// C++ for one instruction. sets pc_written when it leaves pc where execution continues
+static std::string Translate(uint16_t opcode, DecodedOp const &op, uint16_t next, bool &pc_written)
+{
+    const std::string Vx = Reg(op.x);
+    const std::string Vy = Reg(op.y);
+    const std::string VF = Reg(0xF);
+    const std::string kk = Hex(op.kk, 2);
+    pc_written = false;
+
+    switch (op.id)
+    {
+    case ID_6xkk: return Vx + " = " + kk + ";";
+    case ID_7xkk: return Vx + " += " + kk + ";";
+    case ID_8xy0: return Vx + " = " + Vy + ";";
+    case ID_8xy1: return Vx + " |= " + Vy + ";";
+    case ID_8xy2: return Vx + " &= " + Vy + ";";
+    case ID_8xy3: return Vx + " ^= " + Vy + ";";
+    // the 8xy4 to 8xyE forms copy the Chip8::OP_8xy* handlers exactly, quirks included
+    case ID_8xy4: return "{ uint16_t sum = " + Vx + " + " + Vy + "; " + Vx + " = sum & 0xFFu; " + VF + " = sum > 255 ? 1 : 0; }";
+    case ID_8xy5: return "{ uint16_t difference = " + Vx + " - " + Vy + "; " + Vx + " = difference; " + VF + " = " + Vx + " > " + Vy + " ? 1 : 0; }";
+    case ID_8xy6: return "{ uint8_t shifted_out = " + Vx + " & 0x01u; " + Vx + " = " + Vy + " >> 1u; " + VF + " = shifted_out; }";
+    case ID_8xy7: return "{ uint16_t difference = " + Vy + " - " + Vx + "; " + Vx + " = difference; " + VF + " = " + Vy + " > " + Vx + " ? 1 : 0; }";
+    case ID_8xyE: return "{ uint8_t shifted_out = " + Vx + " & 0x80u; " + Vx + " = " + Vy + " << 1u; " + VF + " = shifted_out; }";
+    case ID_Annn: return "index = " + Hex(op.nnn, 3) + ";";
+    case ID_Fx1E: return "index += " + Vx + ";";
+    case ID_Fx07: return Vx + " = delay_timer;";
+    case ID_Fx15: return "delay_timer = " + Vx + ";";
+    case ID_1nnn:
+        if (!IsShortJumpBack(next - 2, op.nnn))
+        {
+            pc_written = true;
+            return "pc = " + Hex(op.nnn, 3) + ";";
+        }
+        break;
+    case ID_3xkk:
+        pc_written = true;
+        return "pc = " + Vx + " == " + kk + " ? " + Hex(next + 2, 3) + " : " + Hex(next, 3) + ";";
+    case ID_4xkk:
+        pc_written = true;
+        return "pc = " + Vx + " != " + kk + " ? " + Hex(next + 2, 3) + " : " + Hex(next, 3) + ";";
+    case ID_5xy0:
+        pc_written = true;
+        return "pc = " + Vx + " == " + Vy + " ? " + Hex(next + 2, 3) + " : " + Hex(next, 3) + ";";
+    case ID_9xy0:
+        pc_written = true;
+        return "pc = " + Vx + " != " + Vy + " ? " + Hex(next + 2, 3) + " : " + Hex(next, 3) + ";";
+    default:
+        break;
+    }
+
+    // everything else goes through the interpreter's handler, which may move pc itself
+    pc_written = true;
+    return "pc = " + Hex(next, 3) + "; layout.fallback(chip8, " + Hex(opcode, 4) + ");";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " [ROM File] [Output C++ File]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open " << argv[1] << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    rom.resize(std::min<size_t>(rom.size(), 4096 - START_ADDRESS));
+
+    const uint32_t rom_end = START_ADDRESS + rom.size();
+    auto fetch = [&](uint32_t address) -> uint16_t {
+        return (rom[address - START_ADDRESS] << 8u) | rom[address + 1 - START_ADDRESS];
+    };
+
+    // walk every block reachable from 0x200. Bnnn targets and 00EE are only known at
+    // runtime: 00EE lands after a 2nnn, which is queued anyway, Bnnn is left to the interpreter
+    std::map<uint16_t, BlockInfo> blocks;
+    std::vector<uint16_t> work{START_ADDRESS};
+    while (!work.empty())
+    {
+        uint16_t start = work.back();
+        work.pop_back();
+        if (blocks.count(start) || start < START_ADDRESS || start + 1u >= rom_end)
+        {
+            continue;
+        }
+
+        BlockInfo info{start, 0, ""};
+        uint16_t address = start;
+        bool pc_written = false;
+        bool ended = false;
+
+        while (address + 1u < rom_end && info.length < MAX_BLOCK_LENGTH)
+        {
+            const uint16_t opcode = fetch(address);
+            const DecodedOp op = DecodeOp(opcode);
+            const uint16_t next = address + 2;
+
+            info.body += "    " + Translate(opcode, op, next, pc_written) + " // " + Hex(address, 3) + "\n";
+            info.length++;
+            address = next;
+
+            if (EndsCompiledBlock(op.id))
+            {
+                ended = true;
+                switch (op.id)
+                {
+                case ID_1nnn:
+                    work.push_back(op.nnn);
+                    break;
+                case ID_2nnn:
+                    work.push_back(op.nnn);
+                    work.push_back(next);
+                    break;
+                case ID_3xkk:
+                case ID_4xkk:
+                case ID_5xy0:
+                case ID_9xy0:
+                case ID_Ex9E:
+                case ID_ExA1:
+                    work.push_back(next);
+                    work.push_back(next + 2);
+                    break;
+                case ID_00EE:
+                case ID_Bnnn:
+                    break;
+                default:
+                    // Fx0A, memory writes, events and invalid opcodes carry on with the next instruction
+                    work.push_back(next);
+                    break;
+                }
+                break;
+            }
+        }
+
+        if (!ended)
+        {
+            work.push_back(address);
+        }
+        if (!pc_written)
+        {
+            info.body += "    pc = " + Hex(address, 3) + ";\n";
+        }
+        info.end = address;
+        blocks[start] = info;
+    }
+
+    if (blocks.empty())
+    {
+        std::cerr << "No code reachable from 0x200 in " << argv[1] << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::ofstream out(argv[2]);
+    out << "// generated by chip8-aot from " << argv[1] << ", do not edit\n"
+        << "#include \"aot.h\"\n\n";
+
+    for (auto const &[start, info] : blocks)
+    {
+        out << "static void block_" << Hex(start, 3).substr(2) << "(AotLayout const &layout, void *chip8)\n{\n"
+            << "    char *base = static_cast<char *>(chip8);\n"
+            << "    [[maybe_unused]] uint8_t *V = reinterpret_cast<uint8_t *>(base + layout.registers);\n"
+            << "    [[maybe_unused]] uint16_t &index = *reinterpret_cast<uint16_t *>(base + layout.index);\n"
+            << "    [[maybe_unused]] uint16_t &pc = *reinterpret_cast<uint16_t *>(base + layout.pc);\n"
+            << "    [[maybe_unused]] uint8_t &delay_timer = *reinterpret_cast<uint8_t *>(base + layout.delay_timer);\n"
+            << info.body << "}\n\n";
+    }
+
+    out << "static const uint8_t rom[] = {";
+    for (size_t i = 0; i < rom.size(); i++)
+    {
+        out << (i % 16 == 0 ? "\n    " : " ") << Hex(rom[i], 2) << ",";
+    }
+    out << "\n};\n\n";
+
+    out << "static const AotBlock blocks[] = {\n";
+    for (auto const &[start, info] : blocks)
+    {
+        out << "    {" << Hex(start, 3) << ", " << Hex(info.end, 3) << ", " << info.length
+            << ", block_" << Hex(start, 3).substr(2) << "},\n";
+    }
+    out << "};\n\n";
+
+    out << "extern const AotProgram CHIP8_AOT_PROGRAM = {rom, sizeof(rom), blocks, sizeof(blocks) / sizeof(blocks[0])};\n";
+
+    std::cerr << "compiled " << blocks.size() << " blocks from " << rom.size() << " bytes" << std::endl;
+    return 0;
+}
@@ -0,0 +1,333 @@
+#include "chip8.h"
+#include "rewind.h"
+#include "runahead.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// arithmetic, skips, a call/return and a jump back, without any instruction that exits Run() early
+static const uint16_t BENCH_PROGRAM[] = {
+    0x6000, // 200: V0 = 0
+    0x6101, // 202: V1 = 1
+    0xA300, // 204: I = 0x300
+    0x8014, // 206: V0 += V1
+    0x8103, // 208: V1 ^= V0
+    0x7102, // 20A: V1 += 2
+    0x3000, // 20C: skip if V0 == 0
+    0x2220, // 20E: call 0x220
+    0x8206, // 210: V2 = V0 >> 1
+    0xF21E, // 212: I += V2
+    0x4205, // 214: skip if V2 != 5
+    0x8304, // 216: V3 += V0
+    0x1206, // 218: jump 0x206
+    0x0000, // 21A
+    0x0000, // 21C
+    0x0000, // 21E
+    0x8424, // 220: V4 += V2
+    0xA300, // 222: I = 0x300
+    0x00EE  // 224: return
+};
+
+// BENCH_PROGRAM has no pair DispatchMode::Fused knows, so this one is nothing but pairs
+static const uint16_t FUSION_PROGRAM[] = {
+    0x6101, // 200: V1 = 1            load+load
+    0x6202, // 202: V2 = 2
+    0xF407, // 204: V4 = delay timer  timer poll
+    0x3401, // 206: skip if V4 == 1
+    0x4000, // 208: skip if V0 != 0   skip+jump, the skip is taken once V0 counts up
+    0x120C, // 20A: jump 0x20C
+    0x7001, // 20C: V0 += 1           add+jump
+    0x1200  // 20E: jump 0x200
+};
+
+// BENCH_PROGRAM never writes memory, so forking it copies nothing. this one stores into two
+// pages every loop, the case fork's copy on write exists to keep cheap
+static const uint16_t STORE_PROGRAM[] = {
+    0xA300, // 200: I = 0x300
+    0xF033, // 202: BCD of V0 at I
+    0x7001, // 204: V0 += 1
+    0xA400, // 206: I = 0x400
+    0xF355, // 208: store V0..V3 at I
+    0x1200  // 20A: jump 0x200
+};
+
+template <size_t N>
+static std::vector<uint8_t> ProgramRom(uint16_t const (&program)[N])
+{
+    std::vector<uint8_t> rom;
+    for (uint16_t word : program)
+    {
+        rom.push_back(word >> 8u);
+        rom.push_back(word & 0xFFu);
+    }
+    return rom;
+}
+
+// runs 'instructions' instructions with the given dispatch mode and returns instructions per second
+static double MeasureIps(DispatchMode mode, std::vector<uint8_t> const &rom, uint64_t instructions)
+{
+    Chip8 chip8(mode);
+    chip8.LoadRom(rom.data(), rom.size());
+
+    // one timer frame per batch, so Run() hands each batch to the backend in one piece
+    const uint32_t batch = 1000000;
+    chip8.SetInstructionsPerFrame(batch);
+    uint64_t executed = 0;
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    while (executed < instructions)
+    {
+        executed += chip8.Run(batch).executed;
+    }
+    const auto endTime = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+    return executed / seconds;
+}
+
+// expands a varied screen 'frames' times with one kernel and returns nanoseconds per frame
+static double MeasureExpand(ExpandKernel kernel, long frames)
+{
+    uint64_t rows[32];
+    for (int y = 0; y < 32; y++)
+    {
+        rows[y] = 0x9E3779B97F4A7C15ull * (y + 1);
+    }
+    static uint32_t argb[64 * 32];
+    const Palette palette = {0xFF102030u, 0xFFE0D0C0u};
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    for (long frame = 0; frame < frames; frame++)
+    {
+        rows[frame & 31] ^= frame; // keeps the compiler from hoisting the work out of the loop
+        ExpandRows(kernel, rows, 32, argb, 64 * sizeof(uint32_t), palette);
+    }
+    const auto endTime = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+    return seconds * 1e9 / frames;
+}
+
+// snapshots a machine running the ROM and restores it 'rounds' times, returns nanoseconds
+// per SaveState and per LoadState
+static void MeasureState(std::vector<uint8_t> const &rom, long rounds, double &saveNs, double &loadNs)
+{
+    Chip8 chip8(DispatchMode::Predecoded);
+    chip8.LoadRom(rom.data(), rom.size());
+    chip8.Run(10000);
+    static Chip8Snapshot snapshot;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (long round = 0; round < rounds; round++)
+    {
+        chip8.keypad[round & 15] ^= 1; // so every snapshot is different
+        chip8.SaveState(snapshot);
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    saveNs = std::chrono::duration<double>(endTime - startTime).count() * 1e9 / rounds;
+
+    startTime = std::chrono::high_resolution_clock::now();
+    for (long round = 0; round < rounds; round++)
+    {
+        snapshot.state.keypad[round & 15] ^= 1;
+        chip8.LoadState(snapshot);
+    }
+    endTime = std::chrono::high_resolution_clock::now();
+    loadNs = std::chrono::duration<double>(endTime - startTime).count() * 1e9 / rounds;
+}
+
+// forks a machine running the ROM every 'interval' instructions, keeping the last 1024 forks
+// alive. returns nanoseconds per fork, and the pages each fork had to copy in pagesPerFork,
+// which is only above zero for a ROM that writes memory between forks
+static double MeasureFork(std::vector<uint8_t> const &rom, long forks, uint32_t interval, double &pagesPerFork)
+{
+    Chip8 chip8(DispatchMode::Predecoded);
+    chip8.LoadRom(rom.data(), rom.size());
+    PagedState first;
+    chip8.SaveState(first); // the first fork copies every page
+    std::vector<PagedState> states(1024);
+    const ForkStats before = chip8.GetForkStats();
+
+    std::chrono::high_resolution_clock::duration forkTime{};
+    for (long fork = 0; fork < forks; fork++)
+    {
+        chip8.Run(interval);
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        chip8.SaveState(states[fork % states.size()]);
+        forkTime += std::chrono::high_resolution_clock::now() - startTime;
+    }
+
+    const ForkStats after = chip8.GetForkStats();
+    pagesPerFork = static_cast<double>(after.pages_copied - before.pages_copied) / forks;
+    return std::chrono::duration<double>(forkTime).count() * 1e9 / forks;
+}
+
+// records 'frames' frames of the ROM into a rewind buffer, then rewinds through all of them.
+// returns the bytes held, and nanoseconds per Push and per Rewind step in pushNs and rewindNs
+static size_t MeasureRewind(std::vector<uint8_t> const &rom, long frames, double &pushNs, double &rewindNs)
+{
+    Chip8 chip8(DispatchMode::Predecoded);
+    chip8.LoadRom(rom.data(), rom.size());
+    chip8.SetInstructionsPerFrame(10);
+    RewindBuffer rewind(frames, 64 << 20);
+
+    std::chrono::high_resolution_clock::duration pushTime{};
+    for (long frame = 0; frame < frames; frame++)
+    {
+        while (!chip8.RunFrame().frame_complete)
+        {
+        }
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        rewind.Push(chip8);
+        pushTime += std::chrono::high_resolution_clock::now() - startTime;
+    }
+    const size_t bytes = rewind.Bytes();
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    long steps = 0;
+    while (rewind.Rewind(chip8))
+    {
+        steps++;
+    }
+    const auto endTime = std::chrono::high_resolution_clock::now();
+
+    pushNs = std::chrono::duration<double>(pushTime).count() * 1e9 / frames;
+    rewindNs = std::chrono::duration<double>(endTime - startTime).count() * 1e9 / std::max(steps, 1L);
+    return bytes;
+}
+
+// frame times of the ROM with 'ahead' frames of run-ahead, on the SDL frontend's dispatch mode
+static FrameTimeStats MeasureRunAhead(std::vector<uint8_t> const &rom, uint32_t ahead, uint32_t instructionsPerFrame, long frames)
+{
+    Chip8 chip8;
+    chip8.LoadRom(rom.data(), rom.size());
+    chip8.SetInstructionsPerFrame(instructionsPerFrame);
+    RunAhead runAhead(ahead);
+    for (long frame = 0; frame < frames; frame++)
+    {
+        runAhead.RunFrame(chip8);
+    }
+    return runAhead.TakeFrameStats();
+}
+
+// nanoseconds per Cxkk byte from the default counter based source, and from the standard library
+// engine and distribution it replaced in stdNs. the sum keeps the loops from being optimised away
+static double MeasureRandom(long bytes, double &stdNs)
+{
+    uint32_t sum = 0;
+    RandomState state = SeedRandom(1);
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (long i = 0; i < bytes; i++)
+    {
+        sum += CounterRandom(state);
+    }
+    const double counterNs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() * 1e9 / bytes;
+
+    std::default_random_engine engine(1);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    startTime = std::chrono::high_resolution_clock::now();
+    for (long i = 0; i < bytes; i++)
+    {
+        sum += static_cast<uint8_t>(distribution(engine));
+    }
+    stdNs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() * 1e9 / bytes;
+
+    volatile uint32_t sink = sum;
+    (void)sink;
+    return counterNs;
+}
+
+int main(int argc, char **argv)
+{
+    // arguments are the number of instructions per backend and an optional ROM file
+    if (argc > 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " [Instructions] [ROM File]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    uint64_t instructions = argc > 1 ? std::stoull(argv[1]) : 50000000;
+    std::vector<uint8_t> rom = ProgramRom(BENCH_PROGRAM);
+    if (argc > 2)
+    {
+        std::ifstream file(argv[2], std::ios::binary);
+        rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    std::cout << std::left << std::setw(10) << "dispatch" << "  " << "instructions/s" << std::endl;
+    for (DispatchMode mode : {DispatchMode::Table, DispatchMode::Flat, DispatchMode::Switch, DispatchMode::Threaded, DispatchMode::Predecoded, DispatchMode::Block, DispatchMode::Jit, DispatchMode::Fused})
+    {
+        double ips = MeasureIps(mode, rom, instructions);
+        std::cout << std::left << std::setw(10) << DispatchModeName(mode) << "  "
+                  << std::fixed << std::setprecision(1) << ips / 1e6 << " M";
+        // the handlers take their operands from a DecodedOp now, so even the original tables
+        // pull every field out of the opcode before dispatching
+        if (mode == DispatchMode::Table)
+        {
+            std::cout << " (includes operand decode)";
+        }
+        std::cout << std::endl;
+    }
+
+    // fused only pays off where pairs are common, on BENCH_PROGRAM it is predecoded plus one
+    // check per instruction
+    const std::vector<uint8_t> pairs = ProgramRom(FUSION_PROGRAM);
+    std::cout << "\n" << std::left << std::setw(10) << "pairs" << "  " << "instructions/s" << std::endl;
+    for (DispatchMode mode : {DispatchMode::Predecoded, DispatchMode::Fused})
+    {
+        std::cout << std::left << std::setw(10) << DispatchModeName(mode) << "  "
+                  << std::fixed << std::setprecision(1) << MeasureIps(mode, pairs, instructions) / 1e6 << " M" << std::endl;
+    }
+
+    std::cout << "\n" << std::left << std::setw(10) << "expand" << "  " << "ns/frame" << std::endl;
+    for (ExpandKernel kernel : {ExpandKernel::Scalar, ExpandKernel::Sse2, ExpandKernel::Avx2})
+    {
+        if (!ExpandKernelSupported(kernel))
+        {
+            continue;
+        }
+        double ns = MeasureExpand(kernel, 1000000);
+        std::cout << std::left << std::setw(10) << ExpandKernelName(kernel) << "  "
+                  << std::fixed << std::setprecision(1) << ns << std::endl;
+    }
+
+    double saveNs, loadNs;
+    MeasureState(rom, 1000000, saveNs, loadNs);
+    std::cout << "\n" << std::left << std::setw(10) << "state" << "  " << "ns" << std::endl;
+    std::cout << std::left << std::setw(10) << "save" << "  " << std::fixed << std::setprecision(1) << saveNs << "\n"
+              << std::left << std::setw(10) << "load" << "  " << std::fixed << std::setprecision(1) << loadNs << std::endl;
+
+    double pagesPerFork;
+    double forkNs = MeasureFork(ProgramRom(STORE_PROGRAM), 1000000, 100, pagesPerFork);
+    std::cout << std::left << std::setw(10) << "fork" << "  " << std::fixed << std::setprecision(1) << forkNs
+              << " (" << std::setprecision(2) << pagesPerFork << " pages copied per fork)" << std::endl;
+
+    // ten minutes of frames at 60 a second
+    double pushNs, rewindNs;
+    size_t rewindBytes = MeasureRewind(rom, 36000, pushNs, rewindNs);
+    std::cout << std::left << std::setw(10) << "push" << "  " << std::fixed << std::setprecision(1) << pushNs
+              << " (10 minutes in " << std::setprecision(2) << rewindBytes / 1048576.0 << " MB)" << "\n"
+              << std::left << std::setw(10) << "rewind" << "  " << std::fixed << std::setprecision(1) << rewindNs << std::endl;
+
+    // a thousand instructions a frame is far more than CHIP-8 games are usually run at
+    std::cout << "\n" << std::left << std::setw(10) << "run-ahead" << "  " << "us/frame avg, max (1000 instructions/frame, " << FRAME_BUDGET_MS << " ms budget)" << std::endl;
+    for (uint32_t ahead = 0; ahead <= 4; ahead++)
+    {
+        FrameTimeStats stats = MeasureRunAhead(rom, ahead, 1000, 6000);
+        std::cout << std::left << std::setw(10) << ahead << "  " << std::fixed << std::setprecision(1) << stats.total_ms * 1000 / stats.frames
+                  << ", " << stats.max_ms * 1000 << " (" << stats.over_budget << " frames over budget)" << std::endl;
+    }
+
+    double stdNs;
+    double counterNs = MeasureRandom(10000000, stdNs);
+    std::cout << "\n" << std::left << std::setw(10) << "random" << "  " << "ns/byte" << std::endl;
+    std::cout << std::left << std::setw(10) << "counter" << "  " << std::fixed << std::setprecision(2) << counterNs << "\n"
+              << std::left << std::setw(10) << "std" << "  " << std::fixed << std::setprecision(2) << stdNs << std::endl;
+
+    return 0;
+}
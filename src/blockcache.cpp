@@ -0,0 +1,158 @@
+#include "blockcache.h"
+#include <algorithm>
+
+void BlockCache::Link(Block *from, uint16_t pc, Block *to)
+{
+    // keep the first successor, the second slot goes to the most recent other one
+    const int slot = (from->link[0] == nullptr || from->link_pc[0] == pc) ? 0 : 1;
+    Block *replaced = from->link[slot];
+    from->link_pc[slot] = pc;
+    from->link[slot] = to;
+    if (replaced == to)
+    {
+        return;
+    }
+
+    if (replaced && replaced != from->link[slot ^ 1])
+    {
+        std::vector<Block *> &sources = replaced->linked_from;
+        sources.erase(std::remove(sources.begin(), sources.end(), from), sources.end());
+    }
+    if (to != from->link[slot ^ 1])
+    {
+        to->linked_from.push_back(from);
+    }
+}
+
+Block *BlockCache::Get(uint8_t const *memory, uint16_t pc)
+{
+    Block *block = blocks[pc & 0x0FFFu].get();
+    if (block)
+    {
+        ++stats.hits;
+        return block;
+    }
+
+    ++stats.misses;
+    return Build(memory, pc & 0x0FFFu);
+}
+
+Block *BlockCache::Build(uint8_t const *memory, uint16_t pc)
+{
+    auto block = std::make_unique<Block>();
+    block->start = pc;
+
+    uint16_t address = pc;
+    // the last instruction has to fit before the end of memory
+    while (address + 1 < 4096 && block->ops.size() < MAX_BLOCK_LENGTH)
+    {
+        DecodedOp op = DecodeOp((memory[address] << 8u) | memory[address + 1]);
+        block->ops.push_back(op);
+        address += 2;
+
+        if (EndsBasicBlock(op.id))
+        {
+            break;
+        }
+    }
+
+    // pc at the very last byte of memory, the lone instruction wraps to the first byte for its
+    // low half like the interpreter's fetch does
+    if (block->ops.empty())
+    {
+        block->ops.push_back(DecodeOp((memory[address] << 8u) | memory[0]));
+        address += 2;
+    }
+
+    block->end = address;
+    for (uint32_t i = pc; i < address; i++)
+    {
+        ++covered[i & 0x0FFFu];
+    }
+
+    blocks[pc] = std::move(block);
+    return blocks[pc].get();
+}
+
+// unlinks the block from everything chained to or from it, then frees it
+void BlockCache::Drop(Block *block)
+{
+    for (Block *from : block->linked_from)
+    {
+        for (int slot = 0; slot < 2; slot++)
+        {
+            if (from->link[slot] == block)
+            {
+                from->link[slot] = nullptr;
+            }
+        }
+    }
+    for (Block *to : block->link)
+    {
+        if (to && to != block)
+        {
+            std::vector<Block *> &sources = to->linked_from;
+            sources.erase(std::remove(sources.begin(), sources.end(), block), sources.end());
+        }
+    }
+
+    for (uint32_t i = block->start; i < block->end; i++)
+    {
+        --covered[i & 0x0FFFu];
+    }
+    ++stats.invalidations;
+    blocks[block->start].reset();
+}
+
+void BlockCache::Invalidate(uint16_t address, uint16_t length)
+{
+    bool hit = false;
+    for (uint32_t i = 0; i < length && !hit; i++)
+    {
+        hit = covered[(address + i) & 0x0FFFu] != 0;
+    }
+    if (!hit)
+    {
+        return;
+    }
+
+    uint32_t start = address & 0x0FFFu;
+    uint32_t end = start + length;
+    if (end > 4096)
+    {
+        start = 0; // wrapped past the end of memory, rare enough to just clear everything
+        end = 4096;
+    }
+    if (pending_end != 0)
+    {
+        start = std::min<uint32_t>(start, pending_start);
+        end = std::max<uint32_t>(end, pending_end);
+    }
+    pending_start = static_cast<uint16_t>(start);
+    pending_end = static_cast<uint16_t>(end);
+}
+
+// drops just the blocks overlapping the written range. a block is at most MAX_BLOCK_LENGTH
+// instructions, so only the ones starting that far before the range can reach into it
+void BlockCache::Flush()
+{
+    const uint32_t reach = MAX_BLOCK_LENGTH * 2 - 1;
+    const uint32_t first = pending_start > reach ? pending_start - reach : 0;
+    for (uint32_t start = first; start < pending_end; start++)
+    {
+        Block *block = blocks[start].get();
+        if (block && block->end > pending_start)
+        {
+            Drop(block);
+        }
+    }
+
+    // the lone instruction at the last byte also reads memory[0]
+    if (pending_start == 0 && blocks[0x0FFF])
+    {
+        Drop(blocks[0x0FFF].get());
+    }
+
+    pending_start = 0;
+    pending_end = 0;
+}
@@ -0,0 +1,79 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "decode.h"
+
+// a run of straight-line instructions ending at the first instruction that can change pc
+// other than by falling through (jumps, calls, returns, skips, Fx0A) or that writes memory
+struct Block
+{
+    uint16_t start;
+    uint16_t end; // one past the last byte
+    std::vector<DecodedOp> ops;
+
+    // successors seen so far, so a hot loop goes block to block without a lookup
+    uint16_t link_pc[2]{};
+    Block *link[2]{};
+    // blocks whose links point here, so dropping this block can unlink them
+    std::vector<Block *> linked_from;
+
+    Block *Successor(uint16_t pc) const
+    {
+        if (link[0] && link_pc[0] == pc)
+        {
+            return link[0];
+        }
+        if (link[1] && link_pc[1] == pc)
+        {
+            return link[1];
+        }
+        return nullptr;
+    }
+};
+
+struct BlockCacheStats
+{
+    uint64_t hits;          // block found by address
+    uint64_t chained;       // block reached through a successor link
+    uint64_t misses;        // block had to be built
+    uint64_t invalidations; // blocks dropped because memory they were built from was written
+};
+
+class BlockCache
+{
+public:
+    // returns the block starting at pc, building it from memory if needed
+    Block *Get(uint8_t const *memory, uint16_t pc);
+
+    // makes 'to' the successor of 'from' when leaving it at pc
+    void Link(Block *from, uint16_t pc, Block *to);
+
+    // records a write to memory[address, address + length). a write into cached code only
+    // marks the range, Flush() drops the blocks overlapping it once the block that did the
+    // write has finished
+    void Invalidate(uint16_t address, uint16_t length);
+    bool FlushPending() const { return pending_end != 0; }
+    void Flush();
+
+    void CountChained() { ++stats.chained; }
+    BlockCacheStats const &Stats() const { return stats; }
+
+    static const size_t MAX_BLOCK_LENGTH = 64;
+
+private:
+    Block *Build(uint8_t const *memory, uint16_t pc);
+    void Drop(Block *block);
+
+    std::array<std::unique_ptr<Block>, 4096> blocks{};
+    std::array<uint8_t, 4096> covered{}; // how many cached blocks each byte belongs to
+    // the written range Flush() has to clear, empty while pending_end is 0
+    uint16_t pending_start = 0;
+    uint16_t pending_end = 0;
+    BlockCacheStats stats{};
+};
+
+#endif
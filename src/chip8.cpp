@@ -1,10 +1,12 @@
 #include "chip8.h"
+#include "trace.h"
 #include <fstream>
-#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <cstring>
 #include <algorithm>
-#include <random>
 #include <chrono>
+#include <vector>
 
 const unsigned int START_ADDRESS = 0x200;
 const unsigned int FONTSET_START_ADDRESS = 0x50;
@@ -28,61 +30,46 @@ uint8_t fontset[FONTSET_SIZE] = {
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().count())
+constexpr Chip8::Chip8Func Chip8::handlers[ID_COUNT] = {
+#define CHIP8_OP_HANDLER(name) &Chip8::OP_##name,
+	CHIP8_OPS(CHIP8_OP_HANDLER)
+#undef CHIP8_OP_HANDLER
+};
+
+// the original two-level tables, shared by every instance. table0, table8 and tableE have an
+// entry for every low nibble and tableF for every low byte, so an opcode without a handler
+// lands on OP_NULL
+constexpr Chip8::Chip8Func Chip8::table[0xF + 1] = {
+	&Chip8::Table0, &Chip8::OP_1nnn, &Chip8::OP_2nnn, &Chip8::OP_3xkk,
+	&Chip8::OP_4xkk, &Chip8::OP_5xy0, &Chip8::OP_6xkk, &Chip8::OP_7xkk,
+	&Chip8::Table8, &Chip8::OP_9xy0, &Chip8::OP_Annn, &Chip8::OP_Bnnn,
+	&Chip8::OP_Cxkk, &Chip8::OP_Dxyn, &Chip8::TableE, &Chip8::TableF};
+
+constexpr Chip8::Chip8Func Chip8::table0[0xF + 1] = {
+	&Chip8::OP_00E0, &Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_00EE, &Chip8::OP_NULL};
+
+constexpr Chip8::Chip8Func Chip8::table8[0xF + 1] = {
+	&Chip8::OP_8xy0, &Chip8::OP_8xy1, &Chip8::OP_8xy2, &Chip8::OP_8xy3,
+	&Chip8::OP_8xy4, &Chip8::OP_8xy5, &Chip8::OP_8xy6, &Chip8::OP_8xy7,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_8xyE, &Chip8::OP_NULL};
+
+constexpr Chip8::Chip8Func Chip8::tableE[0xF + 1] = {
+	&Chip8::OP_NULL, &Chip8::OP_ExA1, &Chip8::OP_NULL, &Chip8::OP_NULL,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_NULL,
+	&Chip8::OP_NULL, &Chip8::OP_NULL, &Chip8::OP_Ex9E, &Chip8::OP_NULL};
+
+constexpr std::array<Chip8::Chip8Func, 0xFF + 1> Chip8::BuildTableF()
 {
-	// initialize RNG
-	randByte = std::uniform_int_distribution<uint8_t>(0, 255U);
-
-	// function pointer table setup
-	// unique opcodes
-	table[0x0] = &Chip8::Table0;
-	table[0x1] = &Chip8::OP_1nnn;
-	table[0x2] = &Chip8::OP_2nnn;
-	table[0x3] = &Chip8::OP_3xkk;
-	table[0x4] = &Chip8::OP_4xkk;
-	table[0x5] = &Chip8::OP_5xy0;
-	table[0x6] = &Chip8::OP_6xkk;
-	table[0x7] = &Chip8::OP_7xkk;
-	table[0x8] = &Chip8::Table8;
-	table[0x9] = &Chip8::OP_9xy0;
-	table[0xA] = &Chip8::OP_Annn;
-	table[0xB] = &Chip8::OP_Bnnn;
-	table[0xC] = &Chip8::OP_Cxkk;
-	table[0xD] = &Chip8::OP_Dxyn;
-	table[0xE] = &Chip8::TableE;
-	table[0xF] = &Chip8::TableF;
-
-	// initializing entries up to 0xE
-	for (size_t i = 0; i <= 0xE; i++)
-	{
-		table0[i] = &Chip8::OP_NULL;
-		table8[i] = &Chip8::OP_NULL;
-		tableE[i] = &Chip8::OP_NULL;
-	}
-
-	// table0 opcodes
-	table0[0x0] = &Chip8::OP_00E0;
-	table0[0xE] = &Chip8::OP_00EE;
-
-	// table8 opcodes
-	table8[0x0] = &Chip8::OP_8xy0;
-	table8[0x1] = &Chip8::OP_8xy1;
-	table8[0x2] = &Chip8::OP_8xy2;
-	table8[0x3] = &Chip8::OP_8xy3;
-	table8[0x4] = &Chip8::OP_8xy4;
-	table8[0x5] = &Chip8::OP_8xy5;
-	table8[0x6] = &Chip8::OP_8xy6;
-	table8[0x7] = &Chip8::OP_8xy7;
-	table8[0xE] = &Chip8::OP_8xyE;
-
-	// tableE opcodes
-	tableE[0x1] = &Chip8::OP_ExA1;
-	tableE[0xE] = &Chip8::OP_Ex9E;
-
-	// initializing tableF up to 0x65
-	for (size_t i = 0; i <= 0x65; i++)
-	{
-		tableF[i] = &Chip8::OP_NULL;
+	// every low byte gets an entry, most of them OP_NULL
+	std::array<Chip8Func, 0xFF + 1> tableF{};
+	for (Chip8Func &entry : tableF)
+	{
+		entry = &Chip8::OP_NULL;
 	}
 
 	// tableF opcodes
@@ -95,6 +82,36 @@ Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().cou
 	tableF[0x33] = &Chip8::OP_Fx33;
 	tableF[0x55] = &Chip8::OP_Fx55;
 	tableF[0x65] = &Chip8::OP_Fx65;
+	return tableF;
+}
+
+constexpr std::array<Chip8::Chip8Func, 0xFF + 1> Chip8::tableF = BuildTableF();
+
+Chip8::Chip8(DispatchMode mode) : dispatch_mode(mode)
+{
+	// initialize RNG
+	SetSeed(std::chrono::system_clock::now().time_since_epoch().count());
+
+	if (dispatch_mode == DispatchMode::Predecoded || dispatch_mode == DispatchMode::Fused)
+	{
+		decoded.reset(new DecodedOp[sizeof(memory)]);
+		InvalidateCode(0, sizeof(memory));
+	}
+	else if (dispatch_mode == DispatchMode::Block)
+	{
+		blocks = std::make_unique<BlockCache>();
+	}
+	else if (dispatch_mode == DispatchMode::Jit && Jit::Supported())
+	{
+		// the generated code addresses state relative to 'this'
+		char *base = reinterpret_cast<char *>(this);
+		JitLayout layout{};
+		layout.registers = static_cast<int32_t>(reinterpret_cast<char *>(registers) - base);
+		layout.index = static_cast<int32_t>(reinterpret_cast<char *>(&index) - base);
+		layout.pc = static_cast<int32_t>(reinterpret_cast<char *>(&pc) - base);
+		layout.delay_timer = static_cast<int32_t>(reinterpret_cast<char *>(&delay_timer) - base);
+		jit = std::make_unique<Jit>(layout, &Chip8::InterpretOpcode);
+	}
 
 	pc = START_ADDRESS; // start at 0x200, since 0x000 to 0x1FF is reserved
 	for (unsigned int i = 0; i < FONTSET_SIZE; i++)
@@ -103,29 +120,1058 @@ Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().cou
 	}
 }
 
+// events raised by instructions, checked by Run() after every instruction
+const uint8_t EVENT_DRAW = 1u << 0;
+const uint8_t EVENT_SOUND = 1u << 1;
+const uint8_t EVENT_WAIT_KEY = 1u << 2;
+const uint8_t EVENT_INVALID = 1u << 3;
+const uint8_t EVENT_IDLE = 1u << 4; // handled by Run() itself, never seen by the host
+
+// the 60 Hz timers, 'ticks' frames worth
+inline void Chip8::TickTimers(uint32_t ticks)
+{
+	delay_timer -= std::min<uint32_t>(delay_timer, ticks);
+	sound_timer -= std::min<uint32_t>(sound_timer, ticks);
+}
+
+// counts instructions against the frame clock. the timers tick once for every frame's worth
+// of instructions, returns true if at least one frame completed
+bool Chip8::AdvanceFrames(uint32_t instructions)
+{
+	instruction_count += instructions;
+	if (instructions < frame_remaining)
+	{
+		frame_remaining -= instructions;
+		return false;
+	}
+
+	instructions -= frame_remaining;
+	TickTimers(1 + instructions / instructions_per_frame);
+	frame_remaining = instructions_per_frame - instructions % instructions_per_frame;
+	return true;
+}
+
+template <DispatchMode Mode>
+inline void Chip8::Step()
+{
+	if constexpr (Mode == DispatchMode::Predecoded)
+	{
+		// FETCH and DECODE only the first time this address runs
+		DecodedOp &entry = decoded[pc & 0x0FFFu];
+		if (entry.id == ID_UNDECODED)
+		{
+			entry = DecodeOp(FetchOpcode(pc));
+		}
+		inst = entry;
+
+		Trace(TraceEvent::Opcode, pc, FetchOpcode(pc));
+		pc += 2;
+
+		DispatchId(inst.id);
+	}
+	else
+	{
+		// FETCH - opcode. the two-level tables and DispatchSwitch find the handler from the
+		// opcode, so only Flat needs the handler id lookup, the others just the operands
+		opcode = FetchOpcode(pc);
+		if constexpr (Mode == DispatchMode::Flat)
+		{
+			inst = DecodeOp(opcode);
+		}
+		else
+		{
+			inst = DecodeOperands(opcode);
+		}
+
+		Trace(TraceEvent::Opcode, pc, opcode);
+
+		// Increment the program counter before we execute anything
+		pc += 2;
+
+		// Decode and Execute
+		if constexpr (Mode == DispatchMode::Table)
+		{
+			((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+		}
+		else if constexpr (Mode == DispatchMode::Flat)
+		{
+			((*this).*(handlers[inst.id]))();
+		}
+		else
+		{
+			DispatchSwitch();
+		}
+	}
+}
+
+// the two bytes at address, wrapping past the end of memory like every other access
+inline uint16_t Chip8::FetchOpcode(uint16_t address) const
+{
+	return (memory[address & 0x0FFFu] << 8u) | memory[(address + 1u) & 0x0FFFu];
+}
+
+// calls the handler for an OpId directly, the compiler turns this into one jump table
+inline void Chip8::DispatchId(uint8_t id)
+{
+	switch (id)
+	{
+#define CHIP8_OP_CASE(name) \
+	case ID_##name:         \
+		OP_##name();        \
+		break;
+		CHIP8_OPS(CHIP8_OP_CASE)
+#undef CHIP8_OP_CASE
+	}
+}
+
+// drops predecoded instructions that overlap a write to memory[address, address + length),
+// and marks the pages the next SaveState(PagedState &) has to copy
+inline void Chip8::InvalidateCode(uint16_t address, uint16_t length)
+{
+	const unsigned first_page = (address & 0x0FFFu) / PAGE_SIZE;
+	const unsigned last_page = ((address + length - 1u) & 0x0FFFu) / PAGE_SIZE;
+	if (length >= sizeof(memory) || last_page < first_page)
+	{
+		written_pages = 0xFFFFu; // wrapped around the end of memory
+	}
+	else
+	{
+		written_pages |= ((2u << last_page) - 1u) & ~((1u << first_page) - 1u);
+	}
+
+	if (blocks)
+	{
+		blocks->Invalidate(address, length);
+	}
+
+	if (jit)
+	{
+		jit->Invalidate(address, length);
+	}
+
+	if (aot)
+	{
+		aot->Validate(memory, address, length);
+	}
+
+	if (!decoded)
+	{
+		return;
+	}
+
+	// an instruction starting one byte before the write has its low byte overwritten, a
+	// superinstruction covers the next instruction too so reaches back three bytes
+	const bool fused = dispatch_mode == DispatchMode::Fused;
+	for (int i = fused ? -3 : -1; i < length; i++)
+	{
+		decoded[(address + i) & 0x0FFFu].id = ID_UNDECODED;
+	}
+
+	// a pair runs its second half from that instruction's entry, so the two entries before the
+	// reset ones can't be pairs anymore. DecodeFused pairs them up again
+	if (fused)
+	{
+		decoded[(address - 5) & 0x0FFFu].fused = FUSED_NONE;
+		decoded[(address - 4) & 0x0FFFu].fused = FUSED_NONE;
+	}
+}
+
+// same mapping as DecodeOpId, but calling the handlers directly so they can be inlined
+inline void Chip8::DispatchSwitch()
+{
+	switch (opcode >> 12u)
+	{
+	case 0x0:
+		switch (opcode & 0x000Fu)
+		{
+		case 0x0: OP_00E0(); break;
+		case 0xE: OP_00EE(); break;
+		default: OP_NULL(); break;
+		}
+		break;
+	case 0x1: OP_1nnn(); break;
+	case 0x2: OP_2nnn(); break;
+	case 0x3: OP_3xkk(); break;
+	case 0x4: OP_4xkk(); break;
+	case 0x5: OP_5xy0(); break;
+	case 0x6: OP_6xkk(); break;
+	case 0x7: OP_7xkk(); break;
+	case 0x8:
+		switch (opcode & 0x000Fu)
+		{
+		case 0x0: OP_8xy0(); break;
+		case 0x1: OP_8xy1(); break;
+		case 0x2: OP_8xy2(); break;
+		case 0x3: OP_8xy3(); break;
+		case 0x4: OP_8xy4(); break;
+		case 0x5: OP_8xy5(); break;
+		case 0x6: OP_8xy6(); break;
+		case 0x7: OP_8xy7(); break;
+		case 0xE: OP_8xyE(); break;
+		default: OP_NULL(); break;
+		}
+		break;
+	case 0x9: OP_9xy0(); break;
+	case 0xA: OP_Annn(); break;
+	case 0xB: OP_Bnnn(); break;
+	case 0xC: OP_Cxkk(); break;
+	case 0xD: OP_Dxyn(); break;
+	case 0xE:
+		switch (opcode & 0x000Fu)
+		{
+		case 0x1: OP_ExA1(); break;
+		case 0xE: OP_Ex9E(); break;
+		default: OP_NULL(); break;
+		}
+		break;
+	default:
+		switch (opcode & 0x00FFu)
+		{
+		case 0x07: OP_Fx07(); break;
+		case 0x0A: OP_Fx0A(); break;
+		case 0x15: OP_Fx15(); break;
+		case 0x18: OP_Fx18(); break;
+		case 0x1E: OP_Fx1E(); break;
+		case 0x29: OP_Fx29(); break;
+		case 0x33: OP_Fx33(); break;
+		case 0x55: OP_Fx55(); break;
+		case 0x65: OP_Fx65(); break;
+		default: OP_NULL(); break;
+		}
+		break;
+	}
+}
+
+char const *DispatchModeName(DispatchMode mode)
+{
+	switch (mode)
+	{
+	case DispatchMode::Table: return "table";
+	case DispatchMode::Flat: return "flat";
+	case DispatchMode::Switch: return "switch";
+	case DispatchMode::Threaded: return "threaded";
+	case DispatchMode::Predecoded: return "predecoded";
+	case DispatchMode::Block: return "block";
+	case DispatchMode::Jit: return "jit";
+	case DispatchMode::Aot: return "aot";
+	case DispatchMode::Fused: return "fused";
+	}
+	return "unknown";
+}
+
+bool ParseDispatchMode(std::string const &name, DispatchMode &mode)
+{
+	for (DispatchMode candidate : {DispatchMode::Table, DispatchMode::Flat, DispatchMode::Switch, DispatchMode::Threaded, DispatchMode::Predecoded, DispatchMode::Block, DispatchMode::Jit, DispatchMode::Aot, DispatchMode::Fused})
+	{
+		if (name == DispatchModeName(candidate))
+		{
+			mode = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
 void Chip8::Cycle()
 {
-	// FETCH - opcode
-	opcode = (memory[pc] << 8u) | memory[pc + 1];
+	Run(1);
+}
+
+// picks the exit reason for whatever events the last instruction raised
+RunResult Chip8::EventResult(uint32_t executed) const
+{
+	if (events & EVENT_INVALID)
+	{
+		return {ExitReason::InvalidOpcode, executed, false};
+	}
+	if (events & EVENT_WAIT_KEY)
+	{
+		return {ExitReason::WaitingForKey, executed, false};
+	}
+	if (events & EVENT_DRAW)
+	{
+		return {ExitReason::ScreenDrawn, executed, false};
+	}
+	if (events & EVENT_SOUND)
+	{
+		return {ExitReason::SoundStarted, executed, false};
+	}
+	// EVENT_IDLE alone, Run() resumes
+	return {ExitReason::BudgetExhausted, executed, false};
+}
+
+// runs up to instructionBudget instructions, stopping early on anything the host has to act on.
+// the budget is cut into slices that end on frame boundaries, where the timers tick, so the
+// backends never touch the timers themselves
+RunResult Chip8::Run(uint32_t instructionBudget)
+{
+	// nothing runs until a key goes down, but the budget still passes as time for the timers
+	if (waiting_for_key && !ResumeFromWait())
+	{
+		const bool frame_complete = AdvanceFrames(instructionBudget);
+		return {ExitReason::WaitingForKey, instructionBudget, frame_complete};
+	}
+
+	RunResult result{ExitReason::BudgetExhausted, 0, false};
+	uint32_t executed = 0;
+	bool frame_complete = false;
 
-	std::cout << std::hex << opcode << std::endl;
+	while (executed < instructionBudget)
+	{
+		// the backends skip the breakpoint check on their first instruction, which is only right
+		// for the first slice
+		if (executed > 0 && breakpoint_count > 0 && breakpoints[pc & 0x0FFFu])
+		{
+			result.reason = ExitReason::Breakpoint;
+			break;
+		}
 
-	// Increment the program counter before we execute anything
+		result = RunSlice(std::min(instructionBudget - executed, frame_remaining));
+		executed += result.executed;
+		frame_complete |= AdvanceFrames(result.executed);
+
+		if (result.reason != ExitReason::BudgetExhausted)
+		{
+			break;
+		}
+	}
+
+	result.executed = executed;
+	result.frame_complete = frame_complete;
+	return result;
+}
+
+// at most the rest of one frame, so the timers hold still for all of it
+RunResult Chip8::RunSlice(uint32_t instructionBudget)
+{
+	RunResult result = Dispatch(instructionBudget);
+	uint32_t executed = result.executed;
+
+	// the backend stopped at the top of an idle loop, skip what the loop would spend and carry on
+	while (events & EVENT_IDLE)
+	{
+		executed += SkipIdle(instructionBudget - executed);
+		result = Dispatch(instructionBudget - executed);
+		executed += result.executed;
+	}
+
+	result.executed = executed;
+	return result;
+}
+
+RunResult Chip8::Dispatch(uint32_t instructionBudget)
+{
+	switch (dispatch_mode)
+	{
+	case DispatchMode::Table:
+		return RunLoop<DispatchMode::Table>(instructionBudget);
+	case DispatchMode::Flat:
+		return RunLoop<DispatchMode::Flat>(instructionBudget);
+	case DispatchMode::Switch:
+		return RunLoop<DispatchMode::Switch>(instructionBudget);
+	case DispatchMode::Threaded:
+		return RunThreaded(instructionBudget);
+	case DispatchMode::Predecoded:
+		return RunLoop<DispatchMode::Predecoded>(instructionBudget);
+	case DispatchMode::Block:
+		return RunBlocks(instructionBudget);
+	case DispatchMode::Jit:
+		return RunJit(instructionBudget);
+	case DispatchMode::Aot:
+		return RunAot(instructionBudget);
+	case DispatchMode::Fused:
+		return RunFused(instructionBudget);
+	}
+	return {ExitReason::BudgetExhausted, 0, false};
+}
+
+template <DispatchMode Mode>
+RunResult Chip8::RunLoop(uint32_t instructionBudget)
+{
+	events = 0;
+	uint32_t executed = 0;
+	const bool check_breakpoints = breakpoint_count > 0;
+
+	while (executed < instructionBudget)
+	{
+		// a breakpoint stops before the instruction runs, but never on the first one so the host can resume
+		if (check_breakpoints && executed > 0 && breakpoints[pc & 0x0FFFu])
+		{
+			return {ExitReason::Breakpoint, executed, false};
+		}
+
+		Step<Mode>();
+		++executed;
+
+		if (events)
+		{
+			return EventResult(executed);
+		}
+	}
+
+	return {ExitReason::BudgetExhausted, executed, false};
+}
+
+// threaded dispatch: every handler ends with its own copy of the fetch and an indirect jump
+// to the next handler, instead of returning to a shared loop
+RunResult Chip8::RunThreaded(uint32_t instructionBudget)
+{
+#if defined(__GNUC__)
+	static void *const labels[ID_COUNT] = {
+#define CHIP8_OP_LABEL(name) &&L_##name,
+		CHIP8_OPS(CHIP8_OP_LABEL)
+#undef CHIP8_OP_LABEL
+	};
+
+	events = 0;
+	uint32_t executed = 0;
+	const bool check_breakpoints = breakpoint_count > 0;
+
+#define DISPATCH()                                                      \
+	if (executed >= instructionBudget)                                  \
+	{                                                                   \
+		return {ExitReason::BudgetExhausted, executed, false};          \
+	}                                                                   \
+	if (check_breakpoints && executed > 0 && breakpoints[pc & 0x0FFFu]) \
+	{                                                                   \
+		return {ExitReason::Breakpoint, executed, false};               \
+	}                                                                   \
+	opcode = FetchOpcode(pc);                                           \
+	inst = DecodeOp(opcode);                                            \
+	Trace(TraceEvent::Opcode, pc, opcode);                              \
+	pc += 2;                                                            \
+	++executed;                                                         \
+	goto *labels[inst.id]
+
+	DISPATCH();
+
+#define CHIP8_OP_BODY(name)           \
+	L_##name:                         \
+	OP_##name();                      \
+	if (events)                       \
+	{                                 \
+		return EventResult(executed); \
+	}                                 \
+	DISPATCH();
+
+	CHIP8_OPS(CHIP8_OP_BODY)
+
+#undef CHIP8_OP_BODY
+#undef DISPATCH
+#else
+	return RunLoop<DispatchMode::Switch>(instructionBudget);
+#endif
+}
+
+// block dispatch: run a cached block's DecodedOps back to back, then follow the block's
+// successor link to the next one. the dispatcher is only involved when a link is missing
+RunResult Chip8::RunBlocks(uint32_t instructionBudget)
+{
+	events = 0;
+	uint32_t executed = 0;
+	const bool check_breakpoints = breakpoint_count > 0;
+	Block *block = nullptr;
+
+	if (blocks->FlushPending())
+	{
+		blocks->Flush();
+	}
+
+	while (executed < instructionBudget)
+	{
+		Block *next = block ? block->Successor(pc) : nullptr;
+		if (next)
+		{
+			blocks->CountChained();
+		}
+		else
+		{
+			next = blocks->Get(memory, pc);
+			if (block)
+			{
+				blocks->Link(block, pc, next);
+			}
+		}
+		block = next;
+
+		// a block can be cut short by the budget, the next Run() starts a block at the new pc
+		const size_t count = std::min<size_t>(block->ops.size(), instructionBudget - executed);
+		DecodedOp const *ops = block->ops.data();
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if (check_breakpoints && executed > 0 && breakpoints[pc & 0x0FFFu])
+			{
+				return {ExitReason::Breakpoint, executed, false};
+			}
+
+			inst = ops[i];
+			Trace(TraceEvent::Opcode, pc, FetchOpcode(pc));
+			pc += 2;
+			DispatchId(inst.id);
+			++executed;
+
+			if (events)
+			{
+				return EventResult(executed);
+			}
+		}
+
+		// only a block's last instruction can write memory, so the block is done with and can
+		// be dropped along with the others the write overlapped
+		if (blocks->FlushPending())
+		{
+			blocks->Flush();
+			block = nullptr;
+		}
+	}
+
+	return {ExitReason::BudgetExhausted, executed, false};
+}
+
+// jit dispatch: run compiled blocks, interpreting single instructions whenever a block
+// doesn't fit the remaining budget or can't be compiled
+RunResult Chip8::RunJit(uint32_t instructionBudget)
+{
+	// generated code neither traces nor checks breakpoints, so leave those to the interpreter
+	if (!jit || !jit->Ready() || breakpoint_count > 0 || TRACE_LEVEL != TraceLevel::Off)
+	{
+		return RunLoop<DispatchMode::Switch>(instructionBudget);
+	}
+
+	events = 0;
+	uint32_t executed = 0;
+
+	while (executed < instructionBudget)
+	{
+		// writes drop the blocks they hit as they happen, and code that keeps being rewritten
+		// never gets a block, so Get() falls through to the interpreter there
+		JitBlock const *block = jit->Get(memory, pc);
+		if (block && block->length <= instructionBudget - executed)
+		{
+			block->code(this);
+			executed += block->length;
+		}
+		else
+		{
+			Step<DispatchMode::Switch>();
+			++executed;
+		}
+
+		// blocks end right after anything that raises an event
+		if (events)
+		{
+			return EventResult(executed);
+		}
+	}
+
+	return {ExitReason::BudgetExhausted, executed, false};
+}
+
+// aot dispatch: same loop as RunJit, over the blocks of a program generated by chip8-aot
+RunResult Chip8::RunAot(uint32_t instructionBudget)
+{
+	if (!aot || breakpoint_count > 0 || TRACE_LEVEL != TraceLevel::Off)
+	{
+		return RunLoop<DispatchMode::Switch>(instructionBudget);
+	}
+
+	events = 0;
+	uint32_t executed = 0;
+
+	while (executed < instructionBudget)
+	{
+		// no block for Bnnn targets, code written at runtime, or a block that doesn't fit the budget
+		AotBlock const *block = aot->Get(pc);
+		if (block && block->length <= instructionBudget - executed)
+		{
+			block->code(aot_layout, this);
+			executed += block->length;
+		}
+		else
+		{
+			Step<DispatchMode::Switch>();
+			++executed;
+		}
+
+		if (events)
+		{
+			return EventResult(executed);
+		}
+	}
+
+	return {ExitReason::BudgetExhausted, executed, false};
+}
+
+// the tables the program points at have to outlive this Chip8, chip8-aot output is a global
+// so they always do
+void Chip8::SetAotProgram(AotProgram const &program)
+{
+	// offsets from 'this' like the jit's, so the blocks follow the machine if it is moved
+	char *base = reinterpret_cast<char *>(this);
+	aot_layout.registers = static_cast<int32_t>(reinterpret_cast<char *>(registers) - base);
+	aot_layout.index = static_cast<int32_t>(reinterpret_cast<char *>(&index) - base);
+	aot_layout.pc = static_cast<int32_t>(reinterpret_cast<char *>(&pc) - base);
+	aot_layout.delay_timer = static_cast<int32_t>(reinterpret_cast<char *>(&delay_timer) - base);
+	aot_layout.fallback = &Chip8::InterpretOpcode;
+
+	aot = std::make_unique<AotRuntime>(program);
+	aot->Validate(memory, 0, sizeof(memory));
+}
+
+// fused dispatch: the predecoded loop, except an entry that starts a known pair runs both
+// instructions at once. a jump into the second instruction finds that instruction's own
+// entry, so it behaves exactly as if nothing had been fused
+RunResult Chip8::RunFused(uint32_t instructionBudget)
+{
+	// a breakpoint could sit on the second instruction of a pair
+	if (breakpoint_count > 0)
+	{
+		return RunLoop<DispatchMode::Predecoded>(instructionBudget);
+	}
+
+	events = 0;
+	uint32_t executed = 0;
+
+	while (executed < instructionBudget)
+	{
+		DecodedOp const &entry = decoded[pc & 0x0FFFu];
+		if (entry.id == ID_UNDECODED)
+		{
+			DecodeFused(pc);
+		}
+
+		// a pair needs room for both instructions in the budget
+		if (entry.fused != FUSED_NONE && instructionBudget - executed >= 2)
+		{
+			executed += ExecuteFused(entry);
+		}
+		else
+		{
+			inst = entry;
+			Trace(TraceEvent::Opcode, pc, FetchOpcode(pc));
+			pc += 2;
+			DispatchId(inst.id);
+			++executed;
+		}
+
+		if (events)
+		{
+			return EventResult(executed);
+		}
+	}
+
+	return {ExitReason::BudgetExhausted, executed, false};
+}
+
+// decodes the instruction at address and marks it fused if it starts a pair with the next one
+void Chip8::DecodeFused(uint16_t address)
+{
+	address &= 0x0FFFu;
+	decoded[address] = DecodeOp(FetchOpcode(address));
+
+	// the instruction before may have lost its pair when this entry was reset
+	DecodedOp &previous = decoded[(address - 2) & 0x0FFFu];
+	if (address >= 2 && previous.id != ID_UNDECODED)
+	{
+		previous.fused = FusePair(previous, decoded[address]);
+	}
+
+	// the second instruction's operands are read from its own entry, so make sure it has one.
+	// an entry decoded here as a second half can start a pair too (runs of 6xkk), so keep
+	// going until the next entry was already decoded and so already had its pair checked
+	for (uint32_t at = address;; at += 2)
+	{
+		const uint32_t next = at + 2;
+		if (next + 1 >= sizeof(memory))
+		{
+			return;
+		}
+
+		const bool fresh = decoded[next].id == ID_UNDECODED;
+		if (fresh)
+		{
+			decoded[next] = DecodeOp((memory[next] << 8u) | memory[next + 1]);
+		}
+		decoded[at].fused = FusePair(decoded[at], decoded[next]);
+		if (!fresh)
+		{
+			return;
+		}
+	}
+}
+
+// runs a pair through the same handlers. returns how many instructions ran: a skip+jump
+// whose skip is taken never runs the jump
+uint32_t Chip8::ExecuteFused(DecodedOp const &first)
+{
+	const uint16_t second_pc = pc + 2;
+	DecodedOp const &second = decoded[second_pc & 0x0FFFu];
+
+	inst = first;
+	Trace(TraceEvent::Opcode, pc, FetchOpcode(pc));
+	pc += 2;
+
+	switch (first.fused)
+	{
+	case FUSED_SKIP_JUMP:
+		if (first.id == ID_3xkk)
+		{
+			OP_3xkk();
+		}
+		else
+		{
+			OP_4xkk();
+		}
+		break;
+	case FUSED_INDEX_DRAW: OP_Annn(); break;
+	case FUSED_LOAD_LOAD: OP_6xkk(); break;
+	case FUSED_TIMER_POLL: OP_Fx07(); break;
+	case FUSED_ADD_JUMP: OP_7xkk(); break;
+	}
+
+	// the skip was taken, the second half is not run
+	if (pc != second_pc)
+	{
+		return 1;
+	}
+
+	inst = second;
+	Trace(TraceEvent::Opcode, pc, FetchOpcode(pc));
 	pc += 2;
 
-	// Decode and Execute
-	((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+	switch (first.fused)
+	{
+	case FUSED_SKIP_JUMP:
+	case FUSED_ADD_JUMP:
+		OP_1nnn();
+		break;
+	case FUSED_INDEX_DRAW: OP_Dxyn(); break;
+	case FUSED_LOAD_LOAD: OP_6xkk(); break;
+	case FUSED_TIMER_POLL:
+		if (second.id == ID_3xkk)
+		{
+			OP_3xkk();
+		}
+		else
+		{
+			OP_4xkk();
+		}
+		break;
+	}
+
+	// only counted once both halves ran, a taken skip above ran a single instruction
+	if constexpr (CHIP8_FUSION_STATS)
+	{
+		++fusion_stats.counts[first.fused];
+	}
+	return 2;
+}
+
+// called from compiled code (Jit, Aot) for instructions it doesn't translate
+void Chip8::InterpretOpcode(void *chip8, uint32_t opcode)
+{
+	Chip8 *self = static_cast<Chip8 *>(chip8);
+	self->opcode = opcode;
+	self->inst = DecodeOp(opcode);
+	self->DispatchId(self->inst.id);
+}
+
+JitStats Chip8::GetJitStats() const
+{
+	return jit ? jit->Stats() : JitStats{};
+}
+
+void Chip8::SetJitPerfMap(bool enabled)
+{
+	if (jit)
+	{
+		jit->SetPerfMap(enabled);
+	}
+}
+
+BlockCacheStats Chip8::GetBlockCacheStats() const
+{
+	return blocks ? blocks->Stats() : BlockCacheStats{};
+}
+
+// the idle loops, each closed by a jump back to its first instruction:
+//   1nnn to itself
+//   Ex9E or ExA1, then the jump: waits on a key
+//   Fx07, then 3xkk or 4xkk on the same Vx, then the jump: waits on the delay timer
+bool Chip8::IsIdleLoop(uint16_t address) const
+{
+	auto fetch = [this](uint32_t at) -> uint16_t {
+		return at + 1 < sizeof(memory) ? (memory[at] << 8u) | memory[at + 1] : 0;
+	};
+
+	address &= 0x0FFFu;
+	const uint16_t jump = 0x1000u | address;
+	const uint16_t first = fetch(address);
+	if (first == jump)
+	{
+		return true;
+	}
+
+	const uint16_t second = fetch(address + 2);
+	if ((first & 0xF0FFu) == 0xE09Eu || (first & 0xF0FFu) == 0xE0A1u)
+	{
+		return second == jump;
+	}
+	if ((first & 0xF0FFu) == 0xF007u)
+	{
+		const uint16_t x = first & 0x0F00u;
+		const uint16_t skip = second & 0xFF00u;
+		return (skip == (0x3000u | x) || skip == (0x4000u | x)) && fetch(address + 4) == jump;
+	}
+	return false;
+}
+
+// pc is at the top of an idle loop: runs as many whole iterations as can't leave the loop in
+// one go, at most 'remaining' instructions. keys only change between Run() calls and the delay
+// timer only ticks between slices, so every iteration in the slice has the same outcome.
+// registers end up exactly as running the iterations would leave them
+uint32_t Chip8::SkipIdle(uint32_t remaining)
+{
+	const uint16_t address = pc & 0x0FFFu;
+	const uint16_t first = FetchOpcode(address);
+	const uint8_t x = (first & 0x0F00u) >> 8u;
+	uint32_t skipped = 0;
+
+	if ((first & 0xF000u) == 0x1000u)
+	{
+		skipped = remaining;
+	}
+	else if ((first & 0xF000u) == 0xE000u)
+	{
+		// Ex9E loops while the key is up, ExA1 while it is down
+		const bool loops_while_down = (first & 0x00FFu) == 0xA1u;
+		if ((keypad[registers[x] & 0x0Fu] != 0) == loops_while_down)
+		{
+			skipped = remaining - remaining % 2;
+		}
+	}
+	else
+	{
+		// Fx07 then 3xkk leaves once Vx == kk, 4xkk once it isn't
+		const uint16_t second = FetchOpcode(address + 2);
+		const uint8_t kk = second & 0x00FFu;
+		const bool leaves_on_equal = (second & 0xF000u) == 0x3000u;
+		if ((delay_timer == kk) != leaves_on_equal && remaining >= 3)
+		{
+			registers[x] = delay_timer;
+			skipped = remaining - remaining % 3;
+		}
+	}
+
+	if (skipped > 0)
+	{
+		++idle_stats.loops;
+		idle_stats.instructions += skipped;
+	}
+	return skipped;
+}
 
-	// Decrement the delay timer if it's been set
-	if (delay_timer > 0)
+// grows the dirty box to cover the given pixels, inclusive
+inline void Chip8::MarkDirty(uint8_t left, uint8_t top, uint8_t right, uint8_t bottom)
+{
+	if (!video_dirty)
 	{
-		--delay_timer;
+		video_dirty = true;
+		dirty_left = left;
+		dirty_top = top;
+		dirty_right = right;
+		dirty_bottom = bottom;
+		return;
 	}
 
-	// Decrement the sound timer if it's been set
-	if (sound_timer > 0)
+	dirty_left = std::min(dirty_left, left);
+	dirty_top = std::min(dirty_top, top);
+	dirty_right = std::max(dirty_right, right);
+	dirty_bottom = std::max(dirty_bottom, bottom);
+}
+
+// ARGB8888 for frontends, pitch is in bytes
+void Chip8::ExpandVideo(uint32_t *argb, int pitch, Palette palette) const
+{
+	ExpandRows(BestExpandKernel(), video, 32, argb, pitch, palette);
+}
+
+// hands the host the part of video to redraw, false if nothing changed since the last call
+bool Chip8::TakeDirtyRect(DirtyRect &rect)
+{
+	if (!video_dirty)
 	{
-		--sound_timer;
+		return false;
+	}
+
+	rect = {dirty_left, dirty_top, dirty_right - dirty_left + 1, dirty_bottom - dirty_top + 1};
+	video_dirty = false;
+	return true;
+}
+
+// the whole machine is one block, so a snapshot is a single copy
+void Chip8::SaveState(Chip8Snapshot &snapshot) const
+{
+	snapshot.magic = SNAPSHOT_MAGIC;
+	snapshot.version = SNAPSHOT_VERSION;
+	snapshot.size = sizeof(Chip8Snapshot);
+	snapshot.state = *this;
+}
+
+// false, leaving the machine alone, if the snapshot is from another version or layout.
+// the caches only have to forget the span of memory that differs, which for rewinding a
+// few frames is usually nothing
+bool Chip8::LoadState(Chip8Snapshot const &snapshot)
+{
+	if (snapshot.magic != SNAPSHOT_MAGIC || snapshot.version != SNAPSHOT_VERSION || snapshot.size != sizeof(Chip8Snapshot))
+	{
+		return false;
+	}
+
+	// the first and last 64 byte chunks of memory that differ, first > last if none do
+	Chip8State const &state = snapshot.state;
+	const int CHUNK = 64;
+	int first = 0;
+	int last = sizeof(memory) - CHUNK;
+	if (memcmp(memory, state.memory, sizeof(memory)) == 0)
+	{
+		first = sizeof(memory);
+	}
+	while (first <= last && memcmp(&memory[first], &state.memory[first], CHUNK) == 0)
+	{
+		first += CHUNK;
+	}
+	while (last >= first && memcmp(&memory[last], &state.memory[last], CHUNK) == 0)
+	{
+		last -= CHUNK;
+	}
+
+	RestoreCore(state);
+	if (first <= last)
+	{
+		memcpy(&memory[first], &state.memory[first], last + CHUNK - first);
+		InvalidateCode(first, last + CHUNK - first);
+	}
+	return true;
+}
+
+// copies in everything but memory. the dirty box describes what the host has shown rather
+// than the machine, so it survives, growing to the whole screen if the video changed
+void Chip8::RestoreCore(Chip8Core const &core)
+{
+	const bool video_changed = memcmp(video, core.video, sizeof(video)) != 0;
+	const bool was_dirty = video_dirty;
+	const uint8_t left = dirty_left, top = dirty_top, right = dirty_right, bottom = dirty_bottom;
+
+	static_cast<Chip8Core &>(*this) = core;
+	video_dirty = was_dirty;
+	dirty_left = left;
+	dirty_top = top;
+	dirty_right = right;
+	dirty_bottom = bottom;
+
+	if (video_changed)
+	{
+		MarkDirty(0, 0, 63, 31);
+	}
+}
+
+// forks the machine. every page not written since the last paged save or load is shared with
+// the states that already hold it, the written ones get a fresh copy
+void Chip8::SaveState(PagedState &state)
+{
+	state.core = *this;
+	for (int page = 0; page < PAGE_COUNT; page++)
+	{
+		if (written_pages & (1u << page))
+		{
+			pages[page].Store(&memory[page * PAGE_SIZE]);
+			++fork_stats.pages_copied;
+		}
+		state.pages[page] = pages[page];
+	}
+	written_pages = 0;
+	++fork_stats.saves;
+}
+
+// false if the state was never saved. a page the machine already shares with the state is
+// skipped, so going back to a recent fork copies little more than the core
+bool Chip8::LoadState(PagedState const &state)
+{
+	if (!state.pages[0])
+	{
+		return false;
+	}
+
+	RestoreCore(state.core);
+	for (int page = 0; page < PAGE_COUNT; page++)
+	{
+		const bool written = written_pages & (1u << page);
+		if (pages[page] == state.pages[page] && !written)
+		{
+			continue;
+		}
+
+		uint8_t *bytes = &memory[page * PAGE_SIZE];
+		if (memcmp(bytes, state.pages[page].Bytes(), PAGE_SIZE) != 0)
+		{
+			memcpy(bytes, state.pages[page].Bytes(), PAGE_SIZE);
+			InvalidateCode(page * PAGE_SIZE, PAGE_SIZE);
+			++fork_stats.pages_loaded;
+		}
+		pages[page] = state.pages[page];
+	}
+	written_pages = 0;
+	++fork_stats.loads;
+	return true;
+}
+
+// finishes a waiting Fx0A if a key is down now, the lowest numbered one wins as in OP_Fx0A
+bool Chip8::ResumeFromWait()
+{
+	for (uint8_t key = 0; key < 16; key++)
+	{
+		if (keypad[key] != 0)
+		{
+			registers[wait_register] = key;
+			waiting_for_key = false;
+			return true;
+		}
+	}
+	return false;
+}
+
+// runs the rest of the current frame. if Run() exits early, the next call carries on with the
+// same frame until frame_complete is set
+RunResult Chip8::RunFrame()
+{
+	return Run(frame_remaining);
+}
+
+// replaces the clock based seed the constructor picks, so Cxkk gives the same bytes every run
+void Chip8::SetSeed(uint64_t seed, uint64_t instance)
+{
+	random = SeedRandom(seed, instance);
+}
+
+void Chip8::SetInstructionsPerFrame(uint32_t count)
+{
+	instructions_per_frame = count > 0 ? count : 1;
+	frame_remaining = instructions_per_frame;
+}
+
+void Chip8::SetBreakpoint(uint16_t address, bool enabled)
+{
+	address &= 0x0FFFu;
+	if (!breakpoints)
+	{
+		breakpoints.reset(new uint8_t[sizeof(memory)]());
+	}
+	if (breakpoints[address] != enabled)
+	{
+		breakpoints[address] = enabled;
+		breakpoint_count += enabled ? 1 : -1;
 	}
 }
 
@@ -149,131 +1195,134 @@ void Chip8::TableF()
 	((*this).*(tableF[opcode & 0x00FFu]))();
 }
 
-void Chip8::OP_NULL() {}
+void Chip8::OP_NULL()
+{
+	events |= EVENT_INVALID;
+}
 
 void Chip8::LoadRom(std::string filename)
 {
-	// creates 'file' object
-	// two flags mean: open file as stream of binary, and move file pointer to the end
-	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	// creates 'file' object, opened as a stream of binary
+	std::ifstream file(filename, std::ios::binary);
 
 	if (file.is_open())
 	{
-		// Get size of file and allocate a buffer to hold the contents
-		// file.tellg() returns the current position of the file pointer (which is the end, due to std::ios::ate)
-		// since the pointer is at the end, it gives the size of the file in bytes
-		std::streampos size = file.tellg();
-		char *buffer = new char[size];
-
-		// Go back to the beginning of the file and fill the buffer
-		file.seekg(0, std::ios::beg); // moves file pointer to offset of 0 from beginning of file
-		file.read(buffer, size);
-		file.close();
+		std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-		// Load the ROM contents into the Chip8's memory, starting at 0x200
-		for (long i = 0; i < size; ++i)
+		// anything past the end of memory isn't a CHIP-8 program, so don't load half of it
+		if (rom.size() > sizeof(memory) - START_ADDRESS)
 		{
-			memory[START_ADDRESS + i] = buffer[i];
+			std::cerr << "ROM " << filename << " is " << rom.size() << " bytes, only "
+					  << sizeof(memory) - START_ADDRESS << " fit after 0x200" << std::endl;
+			return;
 		}
 
-		// Free the buffer
-		delete[] buffer;
+		// Load the ROM contents into the Chip8's memory, starting at 0x200
+		LoadRom(rom.data(), rom.size());
 	}
 }
 
+// Load a ROM that is already in memory, e.g. one built by a test or benchmark
+void Chip8::LoadRom(uint8_t const *data, size_t size)
+{
+	size = std::min(size, sizeof(memory) - START_ADDRESS);
+	memcpy(&memory[START_ADDRESS], data, size);
+	InvalidateCode(START_ADDRESS, size);
+}
+
 // instruction functions
 //  Clear The Display
 // sets all pixels in video buffer to 0
 void Chip8::OP_00E0()
 {
-	std::cout << "Display Cleared." << std::endl;
+	Trace(TraceEvent::DisplayCleared, pc - 2);
 	memset(video, 0, sizeof(video));
+	MarkDirty(0, 0, 63, 31);
+	events |= EVENT_DRAW;
 }
 
 // Jump to Location nnn
-// uses & operator to get the last 3 nibbles of the opcode, sets pc to that value
+// sets pc to nnn, the last 3 nibbles of the opcode
 void Chip8::OP_1nnn()
 {
 	// std::cout << "before Jump, pc = " << std::hex << pc << std::endl;
-	pc = opcode & 0x0FFFu;
+	const uint16_t from = pc - 2;
+	pc = inst.nnn;
 	// std::cout << "after Jump, pc = " << std::hex << pc << std::endl;
+
+	// only a jump at most two instructions back can close an idle loop. skipping would step over
+	// breakpoints and trace output, so not while either is in use
+	if (IsShortJumpBack(from, pc) && idle_skip && breakpoint_count == 0 && TRACE_LEVEL == TraceLevel::Off && IsIdleLoop(pc))
+	{
+		events |= EVENT_IDLE;
+	}
 }
 
 // Set Register Vx == kk
-// isolates 2nd nibble of opcode and shifts it to the right by 8 bits to get register #
-// sets register to last 2 nibbles of opcode
+// register # is the 2nd nibble of the opcode (x)
+// sets register to last 2 nibbles of opcode (kk)
 void Chip8::OP_6xkk()
 {
-	uint8_t register_num = (opcode & 0x0F00u) >> 8u;
-	uint8_t value = opcode & 0x00FFu;
+	uint8_t register_num = inst.x;
+	uint8_t value = inst.kk;
 	registers[register_num] = value;
-	std::cout << "set register" << static_cast<int>(register_num) << " = " << std::hex << static_cast<int>(registers[register_num]) << std::endl;
+	Trace(TraceEvent::SetRegister, pc - 2, register_num, registers[register_num]);
 }
 
 // Add Vx; Vx = Vx + kk
 void Chip8::OP_7xkk()
 {
-	uint8_t register_num = (opcode & 0x0F00u) >> 8u;
-	uint8_t value = opcode & 0x00FFu;
+	uint8_t register_num = inst.x;
+	uint8_t value = inst.kk;
 	registers[register_num] += value;
-	std::cout << "add register" << static_cast<int>(register_num) << " = " << std::hex << static_cast<int>(registers[register_num]) << std::endl;
+	Trace(TraceEvent::AddRegister, pc - 2, register_num, registers[register_num]);
 }
 
 // Set Index Register I; Set I = nnn
 void Chip8::OP_Annn()
 {
-	index = opcode & 0x0FFFu;
-	std::cout << "set index register I =  " << std::hex << static_cast<int>(index) << std::endl;
+	index = inst.nnn;
+	Trace(TraceEvent::SetIndex, pc - 2, index);
 }
 
 // Display/Draw ; Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
 void Chip8::OP_Dxyn()
 {
-	// isolating Vx and Vy from opcode
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u; // isolate 2nd nibble, shift right by 8 bits to get to LSB
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u; // isolate 3rd nibble, shift right by 4 bits to get to LSB
+	// Vx and Vy are the 2nd and 3rd nibbles of the opcode
+	uint8_t Vx = inst.x;
+	uint8_t Vy = inst.y;
 
 	// getting values of Vx and Vy registers
 	uint8_t x_coord = registers[Vx] % 64; //  if x_coord is 68(exceeding display width), it will wrap and become 4
 	uint8_t y_coord = registers[Vy] % 32;
 	// the STARTING POSITION of the sprite wraps, not the actual drawing
 
-	// initializing flag register VF to 0
-	registers[0xF] = 0;
+	events |= EVENT_DRAW;
 
-	// isolating sprite height from opcode
-	uint8_t height = opcode & 0x000Fu;
+	// sprite height is the last nibble of the opcode, rows past the bottom edge are clipped
+	uint8_t height = std::min<uint8_t>(inst.n, 32 - y_coord);
+	uint64_t collided = 0;
+	uint64_t touched = 0;
 
 	for (int row = 0; row < height; row++)
 	{
 		// sprite is loaded into memory location that index register holds,
-		// retrieve each byte from that location, one byte of sprite data = one row
-		uint8_t sprite_byte = memory[index + row];
-		for (int col = 0; col < 8; col++)
-		{
-			// isolating the bit corresponding to current column
-			uint8_t sprite_pixel = sprite_byte & (0x80u >> col);
-
-			// declares screen_pixel as a pointer to an unsigned 32-bit integer
-			// assigns the memory address of the pixel to screen_pixel
-			// screen_pixel points to the memory location of the target pixel,
-			// so we can now use screen_pixel to directly modify that pixel
-			uint32_t *screen_pixel = &video[(y_coord + row) * 32 + (x_coord + col)];
+		// retrieve each byte from that location, one byte of sprite data = one row.
+		// the byte goes in the top 8 bits then moves right to x, so pixels past the right
+		// edge fall off the end of the word
+		uint64_t sprite_row = (static_cast<uint64_t>(memory[(index + row) & 0x0FFFu]) << 56u) >> x_coord;
+
+		// any sprite pixel landing on a lit pixel is a collision, then XOR flips them all
+		collided |= video[y_coord + row] & sprite_row;
+		video[y_coord + row] ^= sprite_row;
+		touched |= sprite_row;
+	}
 
-			// checks if sprite_pixel == 1, or is "on"
-			if (sprite_pixel)
-			{
-				// if screen_pixel is on, set VF flag register to 1
-				if (*screen_pixel == 0xFFFFFFFF)
-				{
-					registers[0xF] = 1;
-				}
-
-				// ^= is bitwise XOR. if screen_pixel is off, it gets turned on.
-				// if screen_pixel is on, it gets turned off
-				*screen_pixel ^= 0xFFFFFFFF;
-			}
-		}
+	// flag register VF is 1 on a collision, 0 otherwise
+	registers[0xF] = collided != 0;
+	if (touched)
+	{
+		MarkDirty(x_coord, y_coord, std::min(x_coord + 7, 63), y_coord + height - 1);
 	}
 }
 
@@ -281,23 +1330,24 @@ void Chip8::OP_Dxyn()
 // done by popping the last address from the stack and setting the PC to it
 void Chip8::OP_00EE()
 {
-	pc = stack.top();
-	stack.pop();
+	sp = (sp - 1) & 0x0Fu;
+	pc = stack[sp];
 }
 
 // 2nnn - CALL addr; Call subroutine at nnn.
 void Chip8::OP_2nnn()
 {
-	stack.push(pc);
-	pc = opcode & 0x0FFFu;
+	stack[sp] = pc;
+	sp = (sp + 1) & 0x0Fu;
+	pc = inst.nnn;
 }
 
 // 3xkk - SE Vx, byte; Skip next instruction if Vx = kk.
 void Chip8::OP_3xkk()
 {
-	uint8_t register_num = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num = inst.x;
 	uint8_t Vx = registers[register_num];
-	uint8_t kk = opcode & 0x00FFu;
+	uint8_t kk = inst.kk;
 	if (Vx == kk)
 	{
 		pc += 2;
@@ -307,9 +1357,9 @@ void Chip8::OP_3xkk()
 // 4xkk - SNE Vx, byte Skip next instruction if Vx != kk.
 void Chip8::OP_4xkk()
 {
-	uint8_t register_num = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num = inst.x;
 	uint8_t Vx = registers[register_num];
-	uint8_t kk = opcode & 0x00FFu;
+	uint8_t kk = inst.kk;
 	if (Vx != kk)
 	{
 		pc += 2;
@@ -319,10 +1369,10 @@ void Chip8::OP_4xkk()
 // 5xy0 - SE Vx, Vy; Skip next instruction if Vx = Vy.
 void Chip8::OP_5xy0()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
 	uint8_t Vx = registers[register_num_x];
 
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_y = inst.y;
 	uint8_t Vy = registers[register_num_y];
 
 	if (Vx == Vy)
@@ -334,10 +1384,10 @@ void Chip8::OP_5xy0()
 // 9xy0 - SE Vx, Vy; Skip next instruction if Vx != Vy.
 void Chip8::OP_9xy0()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
 	uint8_t Vx = registers[register_num_x];
 
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_y = inst.y;
 	uint8_t Vy = registers[register_num_y];
 
 	if (Vx != Vy)
@@ -350,8 +1400,8 @@ void Chip8::OP_9xy0()
 // jumps to address nnn + V0
 void Chip8::OP_Bnnn()
 {
-	uint16_t target_address = opcode & 0x0FFFu;
-	pc = target_address + registers[0x0];
+	uint16_t target_address = inst.nnn;
+	pc = (target_address + registers[0x0]) & 0x0FFFu;
 }
 
 // UNFINISHED
@@ -359,17 +1409,17 @@ void Chip8::OP_Bnnn()
 //  generates a random number, binary ANDs it with value kk, stores in Vx
 void Chip8::OP_Cxkk()
 {
-	uint8_t value = opcode & 0x00FFu;
+	uint8_t value = inst.kk;
 
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	registers[register_num_x] = randByte(randGen) & value;
+	uint8_t register_num_x = inst.x;
+	registers[register_num_x] = random_source(random) & value;
 }
 
 // 8xy0 - LD Vx, Vy ; Set Vx = Vy.
 void Chip8::OP_8xy0()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 
 	registers[register_num_x] = registers[register_num_y];
 }
@@ -378,8 +1428,8 @@ void Chip8::OP_8xy0()
 // 8xy1 - OR Vx, Vy; Set Vx = Vx OR Vy.
 void Chip8::OP_8xy1()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 
 	registers[register_num_x] |= registers[register_num_y];
 }
@@ -387,8 +1437,8 @@ void Chip8::OP_8xy1()
 // 8xy2 - AND Vx, Vy Set Vx = Vx AND Vy.
 void Chip8::OP_8xy2()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 
 	registers[register_num_x] &= registers[register_num_y];
 }
@@ -396,8 +1446,8 @@ void Chip8::OP_8xy2()
 // 8xy3 - XOR Vx, Vy Set Vx = Vx XOR Vy.
 void Chip8::OP_8xy3()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 
 	registers[register_num_x] ^= registers[register_num_y];
 }
@@ -407,8 +1457,8 @@ void Chip8::OP_8xy3()
 
 void Chip8::OP_8xy4()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 	uint16_t sum = registers[register_num_x] + registers[register_num_y];
 	registers[register_num_x] = sum & 0x00FFu;
 	registers[0xF] = sum > 255 ? 1 : 0;
@@ -418,8 +1468,8 @@ void Chip8::OP_8xy4()
 // If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
 void Chip8::OP_8xy5()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 	uint16_t difference = registers[register_num_x] - registers[register_num_y];
 	registers[register_num_x] = difference;
 	registers[0xF] = registers[register_num_x] > registers[register_num_y] ? 1 : 0;
@@ -429,8 +1479,8 @@ void Chip8::OP_8xy5()
 // VF = shifted out bit
 void Chip8::OP_8xy6()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 	uint8_t shifted_out = registers[register_num_x] & 0x01u;
 	registers[register_num_x] = registers[register_num_y] >> 1u;
 	registers[0xF] = shifted_out;
@@ -440,8 +1490,8 @@ void Chip8::OP_8xy6()
 // If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
 void Chip8::OP_8xy7()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 	uint16_t difference = registers[register_num_y] - registers[register_num_x];
 	registers[register_num_x] = difference;
 	registers[0xF] = registers[register_num_y] > registers[register_num_x] ? 1 : 0;
@@ -451,8 +1501,8 @@ void Chip8::OP_8xy7()
 // VF = shifted out bit
 void Chip8::OP_8xyE()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t register_num_y = (opcode & 0x00F0u) >> 4u;
+	uint8_t register_num_x = inst.x;
+	uint8_t register_num_y = inst.y;
 	uint8_t shifted_out = registers[register_num_x] & 0x80u;
 	registers[register_num_x] = registers[register_num_y] << 1u;
 	registers[0xF] = shifted_out;
@@ -461,7 +1511,7 @@ void Chip8::OP_8xyE()
 // Fx07 - sets Vx to the current value of the delay timer
 void Chip8::OP_Fx07()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
 	registers[register_num_x] = delay_timer;
 }
 
@@ -481,11 +1531,14 @@ void Chip8::OP_Fx0A()
 
 	if (pressed_key == -1)
 	{
-		pc -= 2;
+		// pc stays past the instruction, Run() holds in the waiting state until a key goes down
+		waiting_for_key = true;
+		wait_register = inst.x;
+		events |= EVENT_WAIT_KEY;
 	}
 	else
 	{
-		uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+		uint8_t register_num_x = inst.x;
 		registers[register_num_x] = pressed_key;
 	}
 }
@@ -493,28 +1546,32 @@ void Chip8::OP_Fx0A()
 // Fx15 - sets delay timer to the value in Vx
 void Chip8::OP_Fx15()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
 	delay_timer = registers[register_num_x];
 }
 
 // Fx18 - sets sound timer to the value in Vx
 void Chip8::OP_Fx18()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
+	if (sound_timer == 0 && registers[register_num_x] > 0)
+	{
+		events |= EVENT_SOUND;
+	}
 	sound_timer = registers[register_num_x];
 }
 
 // Fx1e - index register incremented by the value in Vx
 void Chip8::OP_Fx1E()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
 	index += registers[register_num_x];
 }
 
 // Fx29 - index register is set to the address of the hex character in Vx
 void Chip8::OP_Fx29()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
 	uint8_t hex_character = registers[register_num_x];
 	index = FONTSET_START_ADDRESS + (5 * hex_character);
 }
@@ -523,50 +1580,52 @@ void Chip8::OP_Fx29()
 // address in index register I.
 void Chip8::OP_Fx33()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
+	uint8_t register_num_x = inst.x;
 	uint8_t num = registers[register_num_x];
 
 	// ones place
-	memory[index + 2] = num % 10;
+	memory[(index + 2) & 0x0FFFu] = num % 10;
 	num /= 10;
 
 	// tens place
-	memory[index + 1] = num % 10;
+	memory[(index + 1) & 0x0FFFu] = num % 10;
 	num /= 10;
 
 	// hundreds place
-	memory[index] = num % 10;
+	memory[index & 0x0FFFu] = num % 10;
+
+	InvalidateCode(index, 3);
 }
 
 // Fx55 - stores the value of each variable register from V0 to VX inclusive
 // in successive memory addresses, starting with the address stored in index register
 void Chip8::OP_Fx55()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t x = registers[register_num_x];
+	uint8_t x = inst.x;
 	for (int i = 0; i <= x; i++)
 	{
-		memory[index + i] = registers[i];
+		memory[(index + i) & 0x0FFFu] = registers[i];
 	}
+
+	InvalidateCode(index, x + 1);
 }
 
 // Fx65 - opposite of Fx55; takes value stored at memory address and loads them into
 // variable registers
 void Chip8::OP_Fx65()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t x = registers[register_num_x];
+	uint8_t x = inst.x;
 	for (int i = 0; i <= x; i++)
 	{
-		registers[i] = memory[index + i];
+		registers[i] = memory[(index + i) & 0x0FFFu];
 	}
 }
 
 // Ex9E - Skip if key corresponding to Vx is pressed
 void Chip8::OP_Ex9E()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vx = registers[register_num_x];
+	uint8_t register_num_x = inst.x;
+	uint8_t Vx = registers[register_num_x] & 0x0Fu;
 	if (keypad[Vx])
 	{
 		pc += 2;
@@ -576,8 +1635,8 @@ void Chip8::OP_Ex9E()
 // ExA1 - Skip if key corresponding to Vx is NOT pressed
 void Chip8::OP_ExA1()
 {
-	uint8_t register_num_x = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vx = registers[register_num_x];
+	uint8_t register_num_x = inst.x;
+	uint8_t Vx = registers[register_num_x] & 0x0Fu;
 	if (!keypad[Vx])
 	{
 		pc += 2;
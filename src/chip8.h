@@ -3,32 +3,233 @@
 
 #include <cstdint>
 #include <string>
-#include <stack>
-#include <random>
+#include <array>
+#include <type_traits>
+#include <memory>
+#include "decode.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "aot.h"
+#include "expand.h"
+#include "paged.h"
+#include "rng.h"
 
-class Chip8
+// why Run() handed control back to the host
+enum class ExitReason
 {
-public:
-    Chip8();
-    void Cycle();
-    void LoadRom(std::string filename);
-    uint32_t video[64 * 32]{};
-    uint8_t keypad[16]{};
+    BudgetExhausted, // ran every instruction it was given
+    WaitingForKey,   // Fx0A found no key down, IsWaitingForKey() holds until one is
+    ScreenDrawn,     // 00E0 or Dxyn changed the video buffer
+    SoundStarted,    // Fx18 turned the sound timer on
+    Breakpoint,      // pc reached an address set with SetBreakpoint
+    InvalidOpcode    // opcode with no handler
+};
 
-private:
+struct RunResult
+{
+    ExitReason reason;
+    uint32_t executed;   // instructions executed by this call
+    bool frame_complete; // a frame's last instruction ran during this call, the timers ticked
+};
+
+// how Run() gets from an opcode to its handler. every mode runs the same OP_* semantics
+enum class DispatchMode
+{
+    Table,      // table[] then table0/table8/tableE/tableF, two member pointer calls
+    Flat,       // 64K handler id table, one member pointer call
+    Switch,     // nested switch, handlers can be inlined
+    Threaded,   // computed goto (GCC/Clang), falls back to Switch elsewhere
+    Predecoded, // memory decoded once into a cache of DecodedOp, switch on the handler id
+    Block,      // cached basic blocks of DecodedOp, chained to their successors
+    Jit,        // basic blocks compiled to x86-64 code, interprets with Switch where unsupported
+    Aot,        // blocks from a chip8-aot generated program, see SetAotProgram
+    Fused       // Predecoded, plus common instruction pairs run as one superinstruction
+};
+
+// counting superinstructions costs a store per pair in the fused loop, so the counters are
+// only compiled in on request, e.g. make FUSION_STATS=1 (run make clean after changing)
+#ifndef CHIP8_FUSION_STATS
+#define CHIP8_FUSION_STATS 0
+#endif
+
+// how many times each superinstruction ran, indexed by FusedId. all zero unless
+// CHIP8_FUSION_STATS is set
+struct FusionStats
+{
+    uint64_t counts[FUSED_COUNT];
+};
+
+// idle loops Run() recognised and skipped instead of running, see SetIdleSkip
+struct IdleStats
+{
+    uint64_t loops;        // times a loop was fast-forwarded
+    uint64_t instructions; // instructions skipped, already counted in RunResult::executed
+};
+
+// the part of video changed since the last TakeDirtyRect(), in pixels
+struct DirtyRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+char const *DispatchModeName(DispatchMode mode);
+bool ParseDispatchMode(std::string const &name, DispatchMode &mode);
+
+// everything that makes up the machine, in one trivially copyable block so a state can be
+// copied with a single memcpy. the small fields every instruction touches come first so they
+// share the first cache line, then the screen, then memory in Chip8State
+struct alignas(64) Chip8Core
+{
     uint8_t registers[16]{};
-    uint8_t memory[4096]{};
+    uint16_t stack[16]{};
     uint16_t index{};
     uint16_t pc{};
-    std::stack<uint16_t> stack{};
-    uint8_t sp{};
+    uint8_t sp{}; // next free stack entry, wraps at 16
     uint8_t delay_timer{};
     uint8_t sound_timer{};
+    bool waiting_for_key{}; // Fx0A found no key down, Vx of wait_register gets the next one
+    uint8_t wait_register{};
+    uint8_t keypad[16]{};
+    // bounding box of the pixels 00E0/Dxyn touched, inclusive. starts dirty so the first frame is shown
+    bool video_dirty = true;
+    uint8_t dirty_left = 0;
+    uint8_t dirty_top = 0;
+    uint8_t dirty_right = 63;
+    uint8_t dirty_bottom = 31;
+    uint32_t instructions_per_frame = 10; // the timers tick once per frame, 60 frames a second
+    uint32_t frame_remaining = 10;
+    uint64_t instruction_count{}; // every instruction Run() has counted as executed, for input logs
+    RandomState random{};
+    uint64_t video[32]{};
+};
+
+struct Chip8State : Chip8Core
+{
+    uint8_t memory[4096]{};
+};
+
+static_assert(std::is_trivially_copyable<Chip8State>::value, "Chip8State has to stay memcpy-able");
+
+const uint32_t SNAPSHOT_MAGIC = 0x38504843u; // "CHP8" in a little endian file
+const uint32_t SNAPSHOT_VERSION = 3;         // bump whenever Chip8State changes
+
+// a whole machine in one fixed-layout block, filled by SaveState and read by LoadState. there
+// are no pointers in it, so it can be written to a file as is and restored straight from a
+// mapping of that file. size catches a snapshot from a build with a different layout
+struct Chip8Snapshot
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    Chip8State state;
+};
+
+// a machine with its memory held as shared copy-on-write pages, for forking many states from
+// one. only valid in the process that saved it
+struct PagedState
+{
+    Chip8Core core;
+    PageRef pages[PAGE_COUNT];
+};
+
+// the machine is the Chip8State base, what Chip8 adds on top is dispatch machinery and caches
+class Chip8 : private Chip8State
+{
+public:
+    Chip8(DispatchMode mode = DispatchMode::Table);
+    void Cycle();
+    RunResult Run(uint32_t instructionBudget);
+    RunResult RunFrame();
+    void SetInstructionsPerFrame(uint32_t count);
+    void SetBreakpoint(uint16_t address, bool enabled = true);
+    // Cxkk's stream, see SeedRandom. batch runs give each machine its own instance number
+    void SetSeed(uint64_t seed, uint64_t instance = 0);
+    void SetRandomSource(RandomSource source) { random_source = source; }
+    uint64_t GetInstructionCount() const { return instruction_count; }
+    void LoadRom(std::string filename);
+    void LoadRom(uint8_t const *data, size_t size);
+    DispatchMode GetDispatchMode() const { return dispatch_mode; }
+    BlockCacheStats GetBlockCacheStats() const;
+    JitStats GetJitStats() const;
+    // names the jit's blocks in /tmp/perf-<pid>.map for perf, also on with CHIP8_PERF_MAP=1
+    void SetJitPerfMap(bool enabled);
+    void SetAotProgram(AotProgram const &program);
+    FusionStats GetFusionStats() const { return fusion_stats; }
+    bool IsWaitingForKey() const { return waiting_for_key; }
+    bool TakeDirtyRect(DirtyRect &rect);
+    void SetIdleSkip(bool enabled) { idle_skip = enabled; }
+    IdleStats GetIdleStats() const { return idle_stats; }
+    // the 64x32 screen, one row per entry with the leftmost pixel in the top bit
+    uint64_t const *GetVideo() const { return video; }
+    void ExpandVideo(uint32_t *argb, int pitch, Palette palette = DEFAULT_PALETTE) const;
+    void SaveState(Chip8Snapshot &snapshot) const;
+    bool LoadState(Chip8Snapshot const &snapshot);
+    void SaveState(PagedState &state);
+    bool LoadState(PagedState const &state);
+    ForkStats GetForkStats() const { return fork_stats; }
+    using Chip8State::keypad;
+
+private:
     uint16_t opcode;
-    std::uniform_int_distribution<uint8_t> randByte;
-    std::default_random_engine randGen;
+    DecodedOp inst{}; // operands of the instruction being executed
+    uint8_t events{};
+    DispatchMode dispatch_mode;
+
+    // one entry per memory address, only allocated for DispatchMode::Predecoded and Fused
+    std::unique_ptr<DecodedOp[]> decoded;
+    FusionStats fusion_stats{};
+    // only allocated for DispatchMode::Block
+    std::unique_ptr<BlockCache> blocks;
+    // only allocated for DispatchMode::Jit
+    std::unique_ptr<Jit> jit;
+    // only set by SetAotProgram
+    std::unique_ptr<AotRuntime> aot;
+    AotLayout aot_layout{};
+
+    // Run() state. breakpoints is only allocated by the first SetBreakpoint
+    uint32_t breakpoint_count{};
+    std::unique_ptr<uint8_t[]> breakpoints;
+    bool idle_skip = true;
+    IdleStats idle_stats{};
+    RandomSource random_source = CounterRandom;
 
-    // function pointer tables (NEEDS IMPLEMENTATION)
+    // the pages of memory as of the last paged save or load, and which have been written since.
+    // empty until the first SaveState(PagedState &)
+    PageRef pages[PAGE_COUNT];
+    uint16_t written_pages = 0xFFFFu;
+    ForkStats fork_stats{};
+
+    RunResult RunSlice(uint32_t instructionBudget);
+    RunResult Dispatch(uint32_t instructionBudget);
+    template <DispatchMode Mode>
+    RunResult RunLoop(uint32_t instructionBudget);
+    RunResult RunThreaded(uint32_t instructionBudget);
+    RunResult RunBlocks(uint32_t instructionBudget);
+    RunResult RunJit(uint32_t instructionBudget);
+    RunResult RunAot(uint32_t instructionBudget);
+    RunResult RunFused(uint32_t instructionBudget);
+    void DecodeFused(uint16_t address);
+    uint32_t ExecuteFused(DecodedOp const &first);
+    static void InterpretOpcode(void *chip8, uint32_t opcode);
+    template <DispatchMode Mode>
+    void Step();
+    void TickTimers(uint32_t ticks);
+    bool AdvanceFrames(uint32_t instructions);
+    bool ResumeFromWait();
+    void DispatchSwitch();
+    void DispatchId(uint8_t id);
+    uint16_t FetchOpcode(uint16_t address) const;
+    void InvalidateCode(uint16_t address, uint16_t length);
+    void RestoreCore(Chip8Core const &core);
+    void MarkDirty(uint8_t left, uint8_t top, uint8_t right, uint8_t bottom);
+    bool IsIdleLoop(uint16_t address) const;
+    uint32_t SkipIdle(uint32_t remaining);
+    RunResult EventResult(uint32_t executed) const;
+
+    // function pointer tables, shared by every instance
     void Table0();
     void Table8();
     void TableE();
@@ -36,11 +237,15 @@ private:
     void OP_NULL();
 
     typedef void (Chip8::*Chip8Func)();
-    Chip8Func table[0xF + 1];
-    Chip8Func table0[0xE + 1];
-    Chip8Func table8[0xE + 1];
-    Chip8Func tableE[0xE + 1];
-    Chip8Func tableF[0x65 + 1];
+    static const Chip8Func table[0xF + 1];
+    static const Chip8Func table0[0xF + 1];
+    static const Chip8Func table8[0xF + 1];
+    static const Chip8Func tableE[0xF + 1];
+    static const std::array<Chip8Func, 0xFF + 1> tableF;
+    static constexpr std::array<Chip8Func, 0xFF + 1> BuildTableF();
+
+    // indexed by OpId, used by the Flat dispatch mode
+    static const Chip8Func handlers[ID_COUNT];
 
     // instruction functions (NEEDS IMPLEMENTATION)
 
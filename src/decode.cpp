@@ -0,0 +1,26 @@
+#include "decode.h"
+
+static constexpr std::array<uint8_t, 0x10000> BuildFlatDecode()
+{
+    std::array<uint8_t, 0x10000> ids{};
+    for (uint32_t opcode = 0; opcode < 0x10000; opcode++)
+    {
+        ids[opcode] = DecodeOpId(static_cast<uint16_t>(opcode));
+    }
+    return ids;
+}
+
+extern constexpr std::array<uint8_t, 0x10000> FLAT_DECODE = BuildFlatDecode();
+
+char const *FusedName(uint8_t fused)
+{
+    switch (fused)
+    {
+    case FUSED_SKIP_JUMP: return "skip+jump";
+    case FUSED_INDEX_DRAW: return "index+draw";
+    case FUSED_LOAD_LOAD: return "load+load";
+    case FUSED_TIMER_POLL: return "timer poll";
+    case FUSED_ADD_JUMP: return "add+jump";
+    default: return "none";
+    }
+}
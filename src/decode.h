@@ -0,0 +1,203 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <array>
+#include <cstdint>
+
+// every instruction handler in handler id order. X(name) stands for Chip8::OP_name,
+// so the id enum, the handler table and the threaded dispatch labels can't drift apart
+#define CHIP8_OPS(X)                                                                   \
+    X(NULL) X(00E0) X(00EE) X(1nnn) X(2nnn) X(3xkk) X(4xkk) X(5xy0) X(6xkk) X(7xkk)    \
+    X(8xy0) X(8xy1) X(8xy2) X(8xy3) X(8xy4) X(8xy5) X(8xy6) X(8xy7) X(8xyE)            \
+    X(9xy0) X(Annn) X(Bnnn) X(Cxkk) X(Dxyn) X(Ex9E) X(ExA1)                            \
+    X(Fx07) X(Fx0A) X(Fx15) X(Fx18) X(Fx1E) X(Fx29) X(Fx33) X(Fx55) X(Fx65)
+
+enum OpId : uint8_t
+{
+#define CHIP8_OP_ID(name) ID_##name,
+    CHIP8_OPS(CHIP8_OP_ID)
+#undef CHIP8_OP_ID
+    ID_COUNT
+};
+
+// maps an opcode to its handler id the same way the table/table0/table8/tableE/tableF
+// lookup in Chip8 does, including which bits each sub-table ignores
+constexpr OpId DecodeOpId(uint16_t opcode)
+{
+    switch (opcode >> 12u)
+    {
+    case 0x0:
+        switch (opcode & 0x000Fu)
+        {
+        case 0x0: return ID_00E0;
+        case 0xE: return ID_00EE;
+        default: return ID_NULL;
+        }
+    case 0x1: return ID_1nnn;
+    case 0x2: return ID_2nnn;
+    case 0x3: return ID_3xkk;
+    case 0x4: return ID_4xkk;
+    case 0x5: return ID_5xy0;
+    case 0x6: return ID_6xkk;
+    case 0x7: return ID_7xkk;
+    case 0x8:
+        switch (opcode & 0x000Fu)
+        {
+        case 0x0: return ID_8xy0;
+        case 0x1: return ID_8xy1;
+        case 0x2: return ID_8xy2;
+        case 0x3: return ID_8xy3;
+        case 0x4: return ID_8xy4;
+        case 0x5: return ID_8xy5;
+        case 0x6: return ID_8xy6;
+        case 0x7: return ID_8xy7;
+        case 0xE: return ID_8xyE;
+        default: return ID_NULL;
+        }
+    case 0x9: return ID_9xy0;
+    case 0xA: return ID_Annn;
+    case 0xB: return ID_Bnnn;
+    case 0xC: return ID_Cxkk;
+    case 0xD: return ID_Dxyn;
+    case 0xE:
+        switch (opcode & 0x000Fu)
+        {
+        case 0x1: return ID_ExA1;
+        case 0xE: return ID_Ex9E;
+        default: return ID_NULL;
+        }
+    default:
+        switch (opcode & 0x00FFu)
+        {
+        case 0x07: return ID_Fx07;
+        case 0x0A: return ID_Fx0A;
+        case 0x15: return ID_Fx15;
+        case 0x18: return ID_Fx18;
+        case 0x1E: return ID_Fx1E;
+        case 0x29: return ID_Fx29;
+        case 0x33: return ID_Fx33;
+        case 0x55: return ID_Fx55;
+        case 0x65: return ID_Fx65;
+        default: return ID_NULL;
+        }
+    }
+}
+
+// one handler id per possible opcode, built at compile time (64 KB)
+extern const std::array<uint8_t, 0x10000> FLAT_DECODE;
+
+// handler id of a predecode cache entry that has not been decoded yet
+const uint8_t ID_UNDECODED = ID_COUNT;
+
+// an instruction with its handler id and operands already pulled out of the opcode
+struct DecodedOp
+{
+    uint8_t id;    // OpId
+    uint8_t x;     // 2nd nibble
+    uint8_t y;     // 3rd nibble
+    uint8_t n;     // last nibble
+    uint8_t kk;    // last byte
+    uint8_t fused; // FusedId of this instruction and the next one, DispatchMode::Fused only
+    uint16_t nnn;  // last 3 nibbles
+};
+
+inline DecodedOp DecodeOp(uint16_t opcode)
+{
+    return {FLAT_DECODE[opcode],
+            static_cast<uint8_t>((opcode & 0x0F00u) >> 8u),
+            static_cast<uint8_t>((opcode & 0x00F0u) >> 4u),
+            static_cast<uint8_t>(opcode & 0x000Fu),
+            static_cast<uint8_t>(opcode & 0x00FFu),
+            0,
+            static_cast<uint16_t>(opcode & 0x0FFFu)};
+}
+
+// just the operands, for dispatch that finds the handler another way. the handlers read their
+// operands from a DecodedOp, this is the field extraction they used to do themselves, without
+// the FLAT_DECODE lookup
+inline DecodedOp DecodeOperands(uint16_t opcode)
+{
+    return {ID_UNDECODED,
+            static_cast<uint8_t>((opcode & 0x0F00u) >> 8u),
+            static_cast<uint8_t>((opcode & 0x00F0u) >> 4u),
+            static_cast<uint8_t>(opcode & 0x000Fu),
+            static_cast<uint8_t>(opcode & 0x00FFu),
+            0,
+            static_cast<uint16_t>(opcode & 0x0FFFu)};
+}
+
+// superinstructions: common pairs of instructions run as one operation
+enum FusedId : uint8_t
+{
+    FUSED_NONE,
+    FUSED_SKIP_JUMP,  // 3xkk/4xkk then 1nnn
+    FUSED_INDEX_DRAW, // Annn then Dxyn
+    FUSED_LOAD_LOAD,  // 6xkk then 6xkk
+    FUSED_TIMER_POLL, // Fx07 then 3xkk/4xkk
+    FUSED_ADD_JUMP,   // 7xkk then 1nnn
+    FUSED_COUNT
+};
+
+inline uint8_t FusePair(DecodedOp const &first, DecodedOp const &second)
+{
+    switch (first.id)
+    {
+    case ID_3xkk:
+    case ID_4xkk:
+        return second.id == ID_1nnn ? FUSED_SKIP_JUMP : FUSED_NONE;
+    case ID_Annn:
+        return second.id == ID_Dxyn ? FUSED_INDEX_DRAW : FUSED_NONE;
+    case ID_6xkk:
+        return second.id == ID_6xkk ? FUSED_LOAD_LOAD : FUSED_NONE;
+    case ID_Fx07:
+        return (second.id == ID_3xkk || second.id == ID_4xkk) ? FUSED_TIMER_POLL : FUSED_NONE;
+    case ID_7xkk:
+        return second.id == ID_1nnn ? FUSED_ADD_JUMP : FUSED_NONE;
+    default:
+        return FUSED_NONE;
+    }
+}
+
+char const *FusedName(uint8_t fused);
+
+// instructions that end a basic block: anything that can change pc other than by falling
+// through, plus the memory writes so an invalidation never lands in the middle of a block
+inline bool EndsBasicBlock(uint8_t id)
+{
+    switch (id)
+    {
+    case ID_1nnn:
+    case ID_2nnn:
+    case ID_00EE:
+    case ID_Bnnn:
+    case ID_3xkk:
+    case ID_4xkk:
+    case ID_5xy0:
+    case ID_9xy0:
+    case ID_Ex9E:
+    case ID_ExA1:
+    case ID_Fx0A:
+    case ID_Fx33:
+    case ID_Fx55:
+    case ID_NULL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// compiled code (Jit, Aot) also ends a block after anything that raises a Run() event,
+// so Run() sees the event right after the instruction that raised it
+inline bool EndsCompiledBlock(uint8_t id)
+{
+    return EndsBasicBlock(id) || id == ID_00E0 || id == ID_Dxyn || id == ID_Fx18;
+}
+
+// a 1nnn at 'from' landing at most two instructions back can close an idle loop, which
+// OP_1nnn checks for. compiled code leaves these jumps to the handler
+inline bool IsShortJumpBack(uint16_t from, uint16_t target)
+{
+    return static_cast<uint16_t>(from - target) <= 4;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include "expand.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CHIP8_EXPAND_X86 1
+#include <immintrin.h>
+#else
+#define CHIP8_EXPAND_X86 0
+#endif
+
+static bool HasAvx2()
+{
+#if CHIP8_EXPAND_X86
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+static uint32_t *Line(void *out, int pitch, int y)
+{
+    return reinterpret_cast<uint32_t *>(static_cast<char *>(out) + y * pitch);
+}
+
+static void ExpandScalar(uint64_t const *rows, int row_count, void *out, int pitch, Palette palette)
+{
+    for (int y = 0; y < row_count; y++)
+    {
+        uint32_t *line = Line(out, pitch, y);
+        const uint64_t row = rows[y];
+        for (int x = 0; x < 64; x++)
+        {
+            line[x] = (row >> (63 - x)) & 1u ? palette.on : palette.off;
+        }
+    }
+}
+
+#if CHIP8_EXPAND_X86
+// each lane tests one bit of a nibble, compares to all-ones where the pixel is lit, then
+// picks between the palette colours as off ^ ((off ^ on) & lit)
+static void ExpandSse2(uint64_t const *rows, int row_count, void *out, int pitch, Palette palette)
+{
+    const __m128i bits = _mm_set_epi32(1, 2, 4, 8);
+    const __m128i off = _mm_set1_epi32(static_cast<int>(palette.off));
+    const __m128i flip = _mm_set1_epi32(static_cast<int>(palette.off ^ palette.on));
+
+    for (int y = 0; y < row_count; y++)
+    {
+        __m128i *line = reinterpret_cast<__m128i *>(Line(out, pitch, y));
+        const uint64_t row = rows[y];
+        for (int i = 0; i < 16; i++)
+        {
+            const __m128i nibble = _mm_set1_epi32(static_cast<int>((row >> (60 - 4 * i)) & 0xFu));
+            const __m128i lit = _mm_cmpeq_epi32(_mm_and_si128(nibble, bits), bits);
+            _mm_storeu_si128(line + i, _mm_xor_si128(off, _mm_and_si128(flip, lit)));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void ExpandAvx2(uint64_t const *rows, int row_count, void *out, int pitch, Palette palette)
+{
+    const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i off = _mm256_set1_epi32(static_cast<int>(palette.off));
+    const __m256i flip = _mm256_set1_epi32(static_cast<int>(palette.off ^ palette.on));
+
+    for (int y = 0; y < row_count; y++)
+    {
+        __m256i *line = reinterpret_cast<__m256i *>(Line(out, pitch, y));
+        const uint64_t row = rows[y];
+        for (int i = 0; i < 8; i++)
+        {
+            const __m256i byte = _mm256_set1_epi32(static_cast<int>((row >> (56 - 8 * i)) & 0xFFu));
+            const __m256i lit = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+            _mm256_storeu_si256(line + i, _mm256_xor_si256(off, _mm256_and_si256(flip, lit)));
+        }
+    }
+}
+#endif
+
+char const *ExpandKernelName(ExpandKernel kernel)
+{
+    switch (kernel)
+    {
+    case ExpandKernel::Scalar: return "scalar";
+    case ExpandKernel::Sse2: return "sse2";
+    case ExpandKernel::Avx2: return "avx2";
+    }
+    return "unknown";
+}
+
+bool ExpandKernelSupported(ExpandKernel kernel)
+{
+    switch (kernel)
+    {
+    case ExpandKernel::Scalar:
+        return true;
+#if CHIP8_EXPAND_X86
+    case ExpandKernel::Sse2:
+        return true; // part of x86-64
+    case ExpandKernel::Avx2:
+        return HasAvx2();
+#endif
+    default:
+        return false;
+    }
+}
+
+ExpandKernel BestExpandKernel()
+{
+    static const ExpandKernel best = ExpandKernelSupported(ExpandKernel::Avx2)   ? ExpandKernel::Avx2
+                                     : ExpandKernelSupported(ExpandKernel::Sse2) ? ExpandKernel::Sse2
+                                                                                 : ExpandKernel::Scalar;
+    return best;
+}
+
+// an unsupported kernel falls back to the scalar one rather than faulting
+void ExpandRows(ExpandKernel kernel, uint64_t const *rows, int row_count, void *out, int pitch, Palette palette)
+{
+#if CHIP8_EXPAND_X86
+    if (kernel == ExpandKernel::Avx2 && HasAvx2())
+    {
+        ExpandAvx2(rows, row_count, out, pitch, palette);
+        return;
+    }
+    if (kernel == ExpandKernel::Sse2)
+    {
+        ExpandSse2(rows, row_count, out, pitch, palette);
+        return;
+    }
+#else
+    (void)kernel;
+#endif
+    ExpandScalar(rows, row_count, out, pitch, palette);
+}
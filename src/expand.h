@@ -0,0 +1,32 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <cstdint>
+
+// turns the packed screen (one uint64_t per row, leftmost pixel in the top bit) into
+// ARGB8888 pixels. the SIMD kernels are only built on x86-64 and picked at runtime
+
+enum class ExpandKernel
+{
+    Scalar, // one pixel at a time, works everywhere
+    Sse2,   // 4 pixels per store
+    Avx2    // 8 pixels per store, if the CPU has it
+};
+
+struct Palette
+{
+    uint32_t off;
+    uint32_t on;
+};
+
+const Palette DEFAULT_PALETTE = {0x00000000u, 0xFFFFFFFFu};
+
+char const *ExpandKernelName(ExpandKernel kernel);
+bool ExpandKernelSupported(ExpandKernel kernel);
+ExpandKernel BestExpandKernel();
+
+// writes row_count rows of 64 pixels to out, rows 'pitch' bytes apart. out doesn't need any
+// alignment, so it can be memory from SDL_LockTexture
+void ExpandRows(ExpandKernel kernel, uint64_t const *rows, int row_count, void *out, int pitch, Palette palette);
+
+#endif
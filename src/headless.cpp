@@ -0,0 +1,105 @@
+#include "chip8.h"
+#include <iostream>
+#include <chrono>
+#include <string>
+
+#ifdef CHIP8_AOT
+// generated by chip8-aot and linked in by the chip8-headless-aot target
+extern const AotProgram CHIP8_AOT_PROGRAM;
+#endif
+
+// FNV-1a hash of the video buffer, so two runs can be compared without a display
+static uint32_t VideoChecksum(const Chip8 &chip8)
+{
+    uint32_t hash = 2166136261u;
+    for (int y = 0; y < 32; y++)
+    {
+        const uint64_t row = chip8.GetVideo()[y];
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            hash = (hash ^ ((row >> shift) & 0xFFu)) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    // arguments are the number of frames, the cycles per frame, the ROM file, an optional dispatch
+    // mode and an optional RNG seed and instance, so runs of a batch each get their own stream
+    DispatchMode dispatchMode = DispatchMode::Table;
+    if (argc < 4 || argc > 7 || (argc >= 5 && !ParseDispatchMode(argv[4], dispatchMode)))
+    {
+        std::cerr << "Usage: " << argv[0] << " [Frames] [Cycles Per Frame] [ROM File] [table|flat|switch|threaded|predecoded|block|jit|aot|fused] [Seed] [Instance]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    long frames = std::stol(argv[1]);
+    long cyclesPerFrame = std::stol(argv[2]);
+    std::string romFile = argv[3];
+
+    Chip8 chip8(dispatchMode);
+    chip8.LoadRom(romFile);
+    if (argc >= 6)
+    {
+        chip8.SetSeed(std::stoull(argv[5]), argc == 7 ? std::stoull(argv[6]) : 0);
+    }
+#ifdef CHIP8_AOT
+    chip8.SetAotProgram(CHIP8_AOT_PROGRAM);
+#endif
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    chip8.SetInstructionsPerFrame(cyclesPerFrame);
+    for (long frame = 0; frame < frames; frame++)
+    {
+        // nothing to draw or play, so every early exit just resumes the frame
+        while (!chip8.RunFrame().frame_complete)
+        {
+        }
+    }
+
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+    double instructions = static_cast<double>(frames) * cyclesPerFrame;
+
+    std::cerr << "frames:       " << frames << "\n"
+              << "instructions: " << static_cast<long long>(instructions) << "\n"
+              << "seconds:      " << seconds << "\n"
+              << "ips:          " << (seconds > 0 ? instructions / seconds : 0) << "\n"
+              << "video hash:   " << std::hex << VideoChecksum(chip8) << std::dec << std::endl;
+
+    IdleStats idle = chip8.GetIdleStats();
+    std::cerr << "idle loops skipped:        " << idle.loops << "\n"
+              << "idle instructions skipped: " << idle.instructions << std::endl;
+
+    if (dispatchMode == DispatchMode::Block)
+    {
+        BlockCacheStats stats = chip8.GetBlockCacheStats();
+        std::cerr << "block hits:          " << stats.hits << "\n"
+                  << "block chained:       " << stats.chained << "\n"
+                  << "block misses:        " << stats.misses << "\n"
+                  << "block invalidations: " << stats.invalidations << std::endl;
+    }
+
+    if (dispatchMode == DispatchMode::Jit)
+    {
+        JitStats stats = chip8.GetJitStats();
+        std::cerr << "jit blocks compiled:       " << stats.blocks_compiled << "\n"
+                  << "jit instructions compiled: " << stats.instructions_compiled << "\n"
+                  << "jit instructions inlined:  " << stats.instructions_inlined << "\n"
+                  << "jit invalidations:         " << stats.invalidations << "\n"
+                  << "jit rewritten lines:       " << stats.rewritten_lines << std::endl;
+    }
+
+    if (dispatchMode == DispatchMode::Fused && CHIP8_FUSION_STATS)
+    {
+        FusionStats stats = chip8.GetFusionStats();
+        for (uint8_t fused = FUSED_NONE + 1; fused < FUSED_COUNT; fused++)
+        {
+            std::cerr << "fused " << FusedName(fused) << ": " << stats.counts[fused] << "\n";
+        }
+    }
+
+    return 0;
+}
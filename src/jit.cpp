@@ -0,0 +1,407 @@
+#include "jit.h"
+#include "decode.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if CHIP8_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// appends x86-64 machine code. every state access is [rbx + disp32], rbx holds the Chip8
+// pointer for the whole block
+class Emitter
+{
+public:
+    explicit Emitter(uint8_t *out) : start(out), cursor(out) {}
+
+    size_t Size() const { return cursor - start; }
+
+    void Byte(uint8_t value) { *cursor++ = value; }
+    void Bytes(std::initializer_list<uint8_t> values)
+    {
+        for (uint8_t value : values)
+        {
+            Byte(value);
+        }
+    }
+    void Imm16(uint16_t value)
+    {
+        memcpy(cursor, &value, 2);
+        cursor += 2;
+    }
+    void Imm32(uint32_t value)
+    {
+        memcpy(cursor, &value, 4);
+        cursor += 4;
+    }
+    void Imm64(uint64_t value)
+    {
+        memcpy(cursor, &value, 8);
+        cursor += 8;
+    }
+
+    // opcode bytes, then ModRM for [rbx + disp32] with 'reg' in the reg field
+    void RbxOp(std::initializer_list<uint8_t> opcode, uint8_t reg, int32_t disp)
+    {
+        Bytes(opcode);
+        Byte(0x80u | (reg << 3u) | 0x03u);
+        Imm32(static_cast<uint32_t>(disp));
+    }
+
+    void MovMem8Imm(int32_t disp, uint8_t value)
+    {
+        RbxOp({0xC6}, 0, disp);
+        Byte(value);
+    }
+    void AddMem8Imm(int32_t disp, uint8_t value)
+    {
+        RbxOp({0x80}, 0, disp);
+        Byte(value);
+    }
+    void CmpMem8Imm(int32_t disp, uint8_t value)
+    {
+        RbxOp({0x80}, 7, disp);
+        Byte(value);
+    }
+    void MovMem16Imm(int32_t disp, uint16_t value)
+    {
+        RbxOp({0x66, 0xC7}, 0, disp);
+        Imm16(value);
+    }
+    void MovAlMem(int32_t disp) { RbxOp({0x8A}, 0, disp); }
+    void MovMemAl(int32_t disp) { RbxOp({0x88}, 0, disp); }
+    void OrMemAl(int32_t disp) { RbxOp({0x08}, 0, disp); }
+    void AndMemAl(int32_t disp) { RbxOp({0x20}, 0, disp); }
+    void XorMemAl(int32_t disp) { RbxOp({0x30}, 0, disp); }
+    void CmpAlMem(int32_t disp) { RbxOp({0x3A}, 0, disp); }
+    void MovzxEaxMem8(int32_t disp) { RbxOp({0x0F, 0xB6}, 0, disp); }
+    void MovzxEcxMem8(int32_t disp) { RbxOp({0x0F, 0xB6}, 1, disp); }
+    void AddMem16Ax(int32_t disp) { RbxOp({0x66, 0x01}, 0, disp); }
+
+    static const size_t MOV_MEM16_IMM_SIZE = 9;
+
+private:
+    uint8_t *start;
+    uint8_t *cursor;
+};
+
+static bool PerfMapRequested()
+{
+    char const *setting = getenv("CHIP8_PERF_MAP");
+    return setting && *setting && strcmp(setting, "0") != 0;
+}
+
+Jit::Jit(JitLayout layout, JitFallback fallback) : layout(layout), fallback(fallback), perf_map_enabled(PerfMapRequested())
+{
+#if CHIP8_JIT_SUPPORTED
+    void *memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+        code_base = static_cast<uint8_t *>(memory);
+    }
+#endif
+}
+
+Jit::~Jit()
+{
+#if CHIP8_JIT_SUPPORTED
+    if (code_base)
+    {
+        munmap(code_base, CODE_SIZE);
+    }
+#endif
+}
+
+bool Jit::Supported()
+{
+    return CHIP8_JIT_SUPPORTED;
+}
+
+JitBlock const *Jit::Get(uint8_t const *memory, uint16_t pc)
+{
+    pc &= 0x0FFFu;
+    int32_t slot = block_at[pc];
+    if (slot)
+    {
+        return &pool[slot - 1];
+    }
+    return Compile(memory, pc);
+}
+
+void Jit::Invalidate(uint16_t address, uint16_t length)
+{
+    bool hit = false;
+    for (uint32_t i = 0; i < length && !hit; i++)
+    {
+        hit = covered[(address + i) & 0x0FFFu] != 0;
+    }
+    if (!hit)
+    {
+        return;
+    }
+
+    uint32_t start = address & 0x0FFFu;
+    uint32_t end = std::min<uint32_t>(start + length, 4096);
+    if (start + length > 4096)
+    {
+        start = 0; // wrapped past the end of memory, rare enough to just check everything
+    }
+
+    // a block is at most MAX_BLOCK_LENGTH instructions, so only the ones starting that far
+    // before the write can reach into it
+    const uint32_t reach = MAX_BLOCK_LENGTH * 2 - 1;
+    for (uint32_t first = start > reach ? start - reach : 0; first < end; first++)
+    {
+        if (!block_at[first])
+        {
+            continue;
+        }
+        JitBlock const &block = pool[block_at[first] - 1];
+        if (block.end <= start)
+        {
+            continue;
+        }
+
+        for (uint32_t i = block.start; i < block.end; i++)
+        {
+            --covered[i];
+        }
+        block_at[first] = 0;
+        ++stats.invalidations;
+    }
+
+    // only the program's own stores count towards a rewritten line. loading a ROM or a
+    // snapshot writes whole chunks of memory at once and says nothing about the code
+    if (length > LINE_SIZE)
+    {
+        return;
+    }
+    for (uint32_t line = start / LINE_SIZE; line <= (end - 1) / LINE_SIZE; line++)
+    {
+        if (rewrites[line] < REWRITE_LIMIT && ++rewrites[line] == REWRITE_LIMIT)
+        {
+            ++stats.rewritten_lines;
+        }
+    }
+}
+
+void Jit::Flush()
+{
+    pool.clear();
+    block_at.fill(0);
+    covered.fill(0);
+    code_used = 0;
+}
+
+JitBlock *Jit::Compile(uint8_t const *memory, uint16_t pc)
+{
+    if (!code_base || pc + 1 >= 4096 || Rewritten(pc) || Rewritten(pc + 1))
+    {
+        return nullptr;
+    }
+
+    // worst case per instruction is a fallback call, well under 128 bytes
+    if (code_used + MAX_BLOCK_LENGTH * 128 > CODE_SIZE)
+    {
+        Flush();
+    }
+
+    uint8_t *code = code_base + code_used;
+    Emitter emit(code);
+
+    const int32_t V = layout.registers;
+    const int32_t VF = layout.registers + 0xF;
+
+    // push rbx; mov rbx, rdi
+    emit.Bytes({0x53, 0x48, 0x89, 0xFB});
+
+    uint16_t address = pc;
+    uint32_t length = 0;
+    bool pc_written = false; // the last instruction left pc where the block should continue
+
+    // the block stops short of code that keeps being rewritten, that is left to the interpreter
+    while (address + 1 < 4096 && length < MAX_BLOCK_LENGTH && !Rewritten(address) && !Rewritten(address + 1))
+    {
+        const uint16_t opcode = (memory[address] << 8u) | memory[address + 1];
+        const DecodedOp op = DecodeOp(opcode);
+        const uint16_t next = address + 2;
+        pc_written = false;
+        bool inlined = true;
+
+        switch (op.id)
+        {
+        case ID_6xkk:
+            emit.MovMem8Imm(V + op.x, op.kk);
+            break;
+
+        case ID_7xkk:
+            emit.AddMem8Imm(V + op.x, op.kk);
+            break;
+
+        case ID_8xy0:
+            emit.MovAlMem(V + op.y);
+            emit.MovMemAl(V + op.x);
+            break;
+
+        case ID_8xy1:
+            emit.MovAlMem(V + op.y);
+            emit.OrMemAl(V + op.x);
+            break;
+
+        case ID_8xy2:
+            emit.MovAlMem(V + op.y);
+            emit.AndMemAl(V + op.x);
+            break;
+
+        case ID_8xy3:
+            emit.MovAlMem(V + op.y);
+            emit.XorMemAl(V + op.x);
+            break;
+
+        case ID_8xy4:
+            // sum in eax, low byte to Vx, then carry to VF (VF last, as OP_8xy4 does)
+            emit.MovzxEaxMem8(V + op.x);
+            emit.MovzxEcxMem8(V + op.y);
+            emit.Bytes({0x01, 0xC8});       // add eax, ecx
+            emit.MovMemAl(V + op.x);
+            emit.Bytes({0xC1, 0xE8, 0x08}); // shr eax, 8
+            emit.MovMemAl(VF);
+            break;
+
+        case ID_Annn:
+            emit.MovMem16Imm(layout.index, op.nnn);
+            break;
+
+        case ID_Fx1E:
+            emit.MovzxEaxMem8(V + op.x);
+            emit.AddMem16Ax(layout.index);
+            break;
+
+        case ID_Fx07:
+            emit.MovAlMem(layout.delay_timer);
+            emit.MovMemAl(V + op.x);
+            break;
+
+        case ID_Fx15:
+            emit.MovAlMem(V + op.x);
+            emit.MovMemAl(layout.delay_timer);
+            break;
+
+        case ID_3xkk:
+        case ID_4xkk:
+        case ID_5xy0:
+        case ID_9xy0:
+            // pc = next, then skip over the following instruction if the condition holds
+            emit.MovMem16Imm(layout.pc, next);
+            if (op.id == ID_3xkk || op.id == ID_4xkk)
+            {
+                emit.CmpMem8Imm(V + op.x, op.kk);
+            }
+            else
+            {
+                emit.MovAlMem(V + op.x);
+                emit.CmpAlMem(V + op.y);
+            }
+            // 3xkk/5xy0 skip when equal, so jump past the skip when not equal, and the other way round
+            emit.Byte((op.id == ID_3xkk || op.id == ID_5xy0) ? 0x75 : 0x74);
+            emit.Byte(Emitter::MOV_MEM16_IMM_SIZE);
+            emit.MovMem16Imm(layout.pc, next + 2);
+            pc_written = true;
+            break;
+
+        case ID_1nnn:
+            if (!IsShortJumpBack(address, op.nnn))
+            {
+                emit.MovMem16Imm(layout.pc, op.nnn);
+                pc_written = true;
+                break;
+            }
+            [[fallthrough]];
+
+        default:
+            // pc = next; fallback(rdi = chip8, esi = opcode), which may move pc itself
+            emit.MovMem16Imm(layout.pc, next);
+            emit.Bytes({0x48, 0x89, 0xDF}); // mov rdi, rbx
+            emit.Byte(0xBE);                // mov esi, imm32
+            emit.Imm32(opcode);
+            emit.Bytes({0x48, 0xB8});       // mov rax, imm64
+            emit.Imm64(reinterpret_cast<uint64_t>(fallback));
+            emit.Bytes({0xFF, 0xD0});       // call rax
+            pc_written = true;
+            inlined = false;
+            break;
+        }
+
+        ++length;
+        ++stats.instructions_compiled;
+        stats.instructions_inlined += inlined;
+        address = next;
+
+        if (EndsCompiledBlock(op.id))
+        {
+            break;
+        }
+    }
+
+    if (length == 0)
+    {
+        return nullptr;
+    }
+
+    if (!pc_written)
+    {
+        emit.MovMem16Imm(layout.pc, address);
+    }
+
+    // pop rbx; ret
+    emit.Bytes({0x5B, 0xC3});
+
+    code_used += (emit.Size() + 15) & ~size_t(15);
+
+    for (uint32_t i = pc; i < address; i++)
+    {
+        ++covered[i];
+    }
+
+    JitBlock block{pc, address, length, reinterpret_cast<JitCode>(code)};
+    pool.push_back(block);
+    block_at[pc] = static_cast<int32_t>(pool.size());
+    ++stats.blocks_compiled;
+
+    if (perf_map_enabled)
+    {
+        WritePerfMap(block, emit.Size());
+    }
+
+    return &pool.back();
+}
+
+// one map per process, however many Jits there are. stdio buffers the writes and exit()
+// flushes them, perf only reads the map after the process is gone
+static FILE *PerfMap()
+{
+#if CHIP8_JIT_SUPPORTED
+    static FILE *const file = []
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+        return fopen(path, "a");
+    }();
+    return file;
+#else
+    return nullptr;
+#endif
+}
+
+void Jit::WritePerfMap(JitBlock const &block, size_t size)
+{
+    FILE *file = PerfMap();
+    if (!file)
+    {
+        perf_map_enabled = false;
+        return;
+    }
+    fprintf(file, "%lx %zx chip8_block_%03x\n", reinterpret_cast<unsigned long>(block.code), size, block.start);
+}
@@ -0,0 +1,105 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// x86-64 only, everywhere else Jit::Supported() is false and Chip8 interprets instead
+#if defined(__x86_64__) && defined(__linux__)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+// where the machine state the generated code touches lives, as byte offsets from the
+// pointer a compiled block is called with
+struct JitLayout
+{
+    int32_t registers;
+    int32_t index;
+    int32_t pc;
+    int32_t delay_timer;
+};
+
+// runs one instruction the generated code doesn't handle itself. pc already points past it
+typedef void (*JitFallback)(void *chip8, uint32_t opcode);
+
+typedef void (*JitCode)(void *chip8);
+
+struct JitBlock
+{
+    uint16_t start;
+    uint16_t end;    // one past the last byte
+    uint32_t length; // instructions
+    JitCode code;
+};
+
+struct JitStats
+{
+    uint64_t blocks_compiled;
+    uint64_t instructions_compiled;
+    uint64_t instructions_inlined; // compiled to native code rather than a fallback call
+    uint64_t invalidations;   // blocks dropped because memory they were compiled from was written
+    uint64_t rewritten_lines; // lines written so often they are interpreted instead
+};
+
+// translates basic blocks into native code in an executable code cache. blocks end at the
+// same instructions as BlockCache blocks, and also after anything that raises a Run() event
+class Jit
+{
+public:
+    Jit(JitLayout layout, JitFallback fallback);
+    ~Jit();
+    Jit(Jit const &) = delete;
+    Jit &operator=(Jit const &) = delete;
+
+    static bool Supported();
+    bool Ready() const { return code_base != nullptr; }
+
+    // returns the compiled block starting at pc, compiling it from memory if needed
+    JitBlock const *Get(uint8_t const *memory, uint16_t pc);
+
+    // drops the blocks overlapping a write to memory[address, address + length). the code of
+    // a dropped block stays where it is until the code cache fills up, so a block can safely
+    // write over itself while it runs
+    void Invalidate(uint16_t address, uint16_t length);
+    // drops every block and starts the code cache over
+    void Flush();
+
+    // writes /tmp/perf-<pid>.map entries for every block so perf can name them. off unless
+    // this or the CHIP8_PERF_MAP environment variable turns it on
+    void SetPerfMap(bool enabled) { perf_map_enabled = enabled; }
+
+    JitStats const &Stats() const { return stats; }
+
+    static const size_t MAX_BLOCK_LENGTH = 64;
+    static const size_t CODE_SIZE = 4 * 1024 * 1024;
+    // memory is tracked in lines this long. once blocks covering a line have been dropped
+    // REWRITE_LIMIT times, the line is self-modifying code that is cheaper to interpret
+    static const size_t LINE_SIZE = 16;
+    static const uint8_t REWRITE_LIMIT = 16;
+
+private:
+    JitBlock *Compile(uint8_t const *memory, uint16_t pc);
+    bool Rewritten(uint16_t address) const { return rewrites[address / LINE_SIZE] >= REWRITE_LIMIT; }
+    void WritePerfMap(JitBlock const &block, size_t size);
+
+    JitLayout layout;
+    JitFallback fallback;
+
+    uint8_t *code_base = nullptr;
+    size_t code_used = 0;
+
+    std::vector<JitBlock> pool;
+    std::array<int32_t, 4096> block_at{}; // index into pool + 1, 0 = not compiled
+    std::array<uint8_t, 4096> covered{};  // how many compiled blocks each byte belongs to
+    std::array<uint8_t, 4096 / LINE_SIZE> rewrites{};
+
+    bool perf_map_enabled;
+
+    JitStats stats{};
+};
+
+#endif
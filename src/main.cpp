@@ -1,62 +1,143 @@
 #include "chip8.h"
 #include "sdldisplay.h"
+#include "rewind.h"
+#include "recording.h"
+#include "runahead.h"
 #include <iostream>
+#include <algorithm>
 #include <chrono>
 #include <string>
+#include <thread>
+
+const int FRAMES_PER_SECOND = 60;
+const int REWIND_SECONDS = 600;       // how far back holding the rewind key can go
+const size_t REWIND_BYTES = 16 << 20; // and the most memory that history may take
+const int MAX_RUN_AHEAD = 4;          // frames, page up and page down step between 0 and this
 
 int main(int argc, char **argv)
 {
-    // check if arguments are valid. arguments are video scale, cycle delay, and the ROM file
-    if (argc != 4)
+    // check if arguments are valid. arguments are video scale, instructions per second, the ROM file,
+    // optionally the off and on colours as ARGB hex, and optionally a file to save the input to
+    if (argc < 4 || argc > 7)
     {
-        std::cout << "Usage: " << argv[0] << " [Video Scale] [Cycle Delay] [ROM File]" << std::endl;
+        std::cout << "Usage: " << argv[0] << " [Video Scale] [Instructions Per Second] [ROM File] [Off Colour] [On Colour] [Recording File]" << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
-    // initialize variables based on arguments. video scale, cycle delay, and the ROM file
+    // initialize variables based on arguments. video scale, target speed, and the ROM file
     int videoScale = std::stoi(argv[1]); // stoi = "string to int"
-    int cycleDelay = std::stoi(argv[2]);
+    int instructionsPerSecond = std::stoi(argv[2]);
     std::string romFile = argv[3];
+    std::string recordingFile = argc == 5 || argc == 7 ? argv[argc - 1] : "";
 
     // initialize the SDL display
     SDLDisplay display("CHIP-8 Emulator", (videoScale * 64), (videoScale * 32), 64, 32);
+    if (argc >= 6)
+    {
+        display.SetPalette({static_cast<uint32_t>(std::stoul(argv[4], nullptr, 16)), static_cast<uint32_t>(std::stoul(argv[5], nullptr, 16))});
+    }
 
     // initialize Chip8, load the ROM file using method in Chip8 class
     Chip8 chip8;
     chip8.LoadRom(romFile);
 
-    // get the video pitch for use in the loop to update the screen.
-    // pitch =  # of bytes in a row of pixel data, including padding between lines
-    // size of one pixel in bytes * # of pixels in a row
-    int videoPitch = sizeof(chip8.video[0]) * 64;
+    // the recorder seeds the RNG and sets the frame length, so chip8-replay can repeat the session.
+    // a frame is one 60 Hz timer tick, so this many instructions run per frame
+    const uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
+    InputRecorder recorder(chip8, seed, std::max(1, instructionsPerSecond / FRAMES_PER_SECOND));
+
+    // one entry per frame, so holding the rewind key goes back in real time
+    RewindBuffer rewind(REWIND_SECONDS * FRAMES_PER_SECOND, REWIND_BYTES);
 
-    // initialize a chrono high resolution clock to keep track of time.
-    auto lastCycleTime = std::chrono::high_resolution_clock::now();
+    // starts off, the screen is then the machine's own
+    RunAhead runAhead(0);
+
+    // every frame has a deadline, the loop sleeps until it instead of spinning
+    const auto framePeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / FRAMES_PER_SECOND));
+    auto nextFrame = std::chrono::steady_clock::now() + framePeriod;
+    auto nextReport = std::chrono::steady_clock::now() + std::chrono::seconds(1);
 
     // initialize a bool to keep track of whether the emulator is running
     bool quit = false;
-    // while loop (while emulator is running)
 
-    std::cout << "before while loop" << std::endl;
     while (!quit)
     {
         quit = display.ProcessInput(chip8.keypad);
-        // get the current time
-        const auto currTime = std::chrono::high_resolution_clock::now();
-        // get the dt (delta time) by subtracting the last time from the current time
-        float deltaTime = std::chrono::duration<float, std::chrono::milliseconds::period>(currTime - lastCycleTime).count();
-        // if the dt is greater than the cycle delay
-        if (deltaTime > cycleDelay)
-        {
-            // update the last time to the current time
-            lastCycleTime = currTime;
-            // call the cycle method in the Chip8 class
-            chip8.Cycle();
-            // update screen
-            display.Update(chip8.video, videoPitch);
-        }
-        // end of loop
+
+        const int steps = display.TakeRunAheadSteps();
+        if (steps != 0)
+        {
+            runAhead.SetFrames(std::clamp(static_cast<int>(runAhead.GetFrames()) + steps, 0, MAX_RUN_AHEAD));
+            std::cout << "run-ahead: " << runAhead.GetFrames() << " frames" << std::endl;
+        }
+
+        if (display.IsRewinding())
+        {
+            // step back one frame instead of running one, the screen is presented as usual
+            rewind.Rewind(chip8);
+            runAhead.Show(chip8);
+        }
+        else
+        {
+            recorder.Record(chip8);
+
+            // run one frame's worth of instructions, then the frames ahead if run-ahead is on.
+            // the machine is left after the one frame, so the rewind buffer and the recording
+            // never see the frames ahead
+            runAhead.RunFrame(chip8);
+            rewind.Push(chip8);
+        }
+
+        // present once per frame, expanding only the rows that changed into the texture
+        DirtyRect dirty;
+        if (runAhead.TakeDirtyRect(dirty))
+        {
+            SDL_Rect rect{dirty.x, dirty.y, dirty.w, dirty.h};
+            display.UpdatePacked(runAhead.GetVideo(), &rect);
+        }
+        else
+        {
+            display.UpdatePacked(runAhead.GetVideo(), nullptr);
+        }
+
+        // once a second, how many frames needed no upload at all, and whether the emulation
+        // (run-ahead included) fits in a frame
+        if (std::chrono::steady_clock::now() >= nextReport)
+        {
+            const FrameTimeStats stats = runAhead.TakeFrameStats();
+            std::cout << "skipped uploads/s: " << display.TakeSkippedUploads()
+                      << ", frame time: " << (stats.frames ? stats.total_ms / stats.frames : 0) << " ms avg, "
+                      << stats.max_ms << " ms max, " << stats.over_budget << " over " << FRAME_BUDGET_MS << " ms" << std::endl;
+            nextReport += std::chrono::seconds(1);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now > nextFrame + framePeriod)
+        {
+            // more than a frame behind (a stall, a dragged window), drop the missed frames
+            // rather than running them back to back
+            nextFrame = now;
+        }
+        else if (chip8.IsWaitingForKey())
+        {
+            // Fx0A is waiting for a key, sleep in SDL so a key press is seen as soon as it happens
+            while (!quit && std::chrono::steady_clock::now() < nextFrame)
+            {
+                const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(nextFrame - std::chrono::steady_clock::now());
+                quit = display.WaitInput(chip8.keypad, static_cast<int>(left.count()));
+            }
+        }
+        else
+        {
+            std::this_thread::sleep_until(nextFrame);
+        }
+        nextFrame += framePeriod;
+    }
+
+    if (!recordingFile.empty() && !recorder.Finish(chip8).Save(recordingFile))
+    {
+        std::cout << "Could not save the recording to " << recordingFile << std::endl;
     }
 
     return 0;
-}
\ No newline at end of file
+}
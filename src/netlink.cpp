@@ -0,0 +1,194 @@
+#include "netlink.h"
+#include <algorithm>
+#include <cstring>
+
+#if CHIP8_NETPLAY_SUPPORTED
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+const uint32_t NETPLAY_MAGIC = 0x504E3843u; // "C8NP" in a little endian packet
+const uint32_t MAX_PACKET_INPUTS = 64;
+
+// the header of every packet, followed by count keypads of 16 bits. little endian, both ends are
+// the same build
+struct InputPacket
+{
+    uint32_t magic;
+    uint32_t count;
+    uint64_t first_frame; // the frame of the first keypad
+    uint64_t ack;         // frames of the receiver's keys the sender has
+};
+
+UdpLink::~UdpLink()
+{
+#if CHIP8_NETPLAY_SUPPORTED
+    if (socket_fd >= 0)
+    {
+        close(socket_fd);
+    }
+#endif
+}
+
+// false if the socket can't be bound to localPort or remoteHost doesn't resolve. only packets
+// from remoteHost:remotePort are received
+bool UdpLink::Open(uint16_t localPort, std::string const &remoteHost, uint16_t remotePort)
+{
+#if CHIP8_NETPLAY_SUPPORTED
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(remoteHost.c_str(), nullptr, &hints, &found) != 0 || !found)
+    {
+        return false;
+    }
+    sockaddr_in remote;
+    memcpy(&remote, found->ai_addr, sizeof(remote));
+    freeaddrinfo(found);
+    remote.sin_port = htons(remotePort);
+
+    socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+    {
+        return false;
+    }
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(localPort);
+    // connecting a datagram socket makes the kernel drop packets from anyone but the peer,
+    // otherwise any host could send us keys
+    if (bind(socket_fd, reinterpret_cast<sockaddr const *>(&local), sizeof(local)) != 0 ||
+        connect(socket_fd, reinterpret_cast<sockaddr const *>(&remote), sizeof(remote)) != 0 ||
+        fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL, 0) | O_NONBLOCK) != 0)
+    {
+        close(socket_fd);
+        socket_fd = -1;
+        return false;
+    }
+    return true;
+#else
+    (void)localPort;
+    (void)remoteHost;
+    (void)remotePort;
+    return false;
+#endif
+}
+
+void UdpLink::SetFaults(uint32_t delayMs, double lossPercent, uint64_t seed)
+{
+    delay = std::chrono::milliseconds(delayMs);
+    loss = lossPercent / 100.0;
+    fault_random.seed(seed);
+}
+
+void UdpLink::Send(void const *data, size_t size)
+{
+    stats.sent++;
+    if (loss > 0 && std::uniform_real_distribution<double>(0, 1)(fault_random) < loss)
+    {
+        stats.dropped++;
+        return;
+    }
+
+    uint8_t const *bytes = static_cast<uint8_t const *>(data);
+    if (delay.count() == 0)
+    {
+        SendNow(bytes, size);
+        return;
+    }
+    delayed.push_back({std::chrono::steady_clock::now() + delay, std::vector<uint8_t>(bytes, bytes + size)});
+    Flush();
+}
+
+void UdpLink::Flush()
+{
+    const auto now = std::chrono::steady_clock::now();
+    while (!delayed.empty() && delayed.front().due <= now)
+    {
+        SendNow(delayed.front().bytes.data(), delayed.front().bytes.size());
+        delayed.pop_front();
+    }
+}
+
+// a full socket buffer loses the packet like the network would, the next one repeats it
+void UdpLink::SendNow(uint8_t const *data, size_t size)
+{
+#if CHIP8_NETPLAY_SUPPORTED
+    if (socket_fd >= 0)
+    {
+        send(socket_fd, data, size, 0);
+    }
+#else
+    (void)data;
+    (void)size;
+#endif
+}
+
+size_t UdpLink::Receive(void *data, size_t capacity)
+{
+#if CHIP8_NETPLAY_SUPPORTED
+    if (socket_fd < 0)
+    {
+        return 0;
+    }
+    const ssize_t size = recv(socket_fd, data, capacity, 0);
+    if (size <= 0)
+    {
+        return 0;
+    }
+    stats.received++;
+    return static_cast<size_t>(size);
+#else
+    (void)data;
+    (void)capacity;
+    return 0;
+#endif
+}
+
+void NetplayPeer::Exchange()
+{
+    uint8_t buffer[sizeof(InputPacket) + MAX_PACKET_INPUTS * sizeof(uint16_t)];
+    size_t size;
+    while ((size = link.Receive(buffer, sizeof(buffer))) != 0)
+    {
+        InputPacket header;
+        if (size < sizeof(header))
+        {
+            continue;
+        }
+        memcpy(&header, buffer, sizeof(header));
+        if (header.magic != NETPLAY_MAGIC || header.count > MAX_PACKET_INPUTS || size != sizeof(header) + header.count * sizeof(uint16_t))
+        {
+            continue;
+        }
+
+        // packets can come out of order, the session skips keys it has or can't place yet
+        for (uint32_t i = 0; i < header.count; i++)
+        {
+            uint16_t keys;
+            memcpy(&keys, &buffer[sizeof(header) + i * sizeof(uint16_t)], sizeof(keys));
+            session.AddRemoteInput(header.first_frame + i, keys);
+        }
+        remote_ack = std::max(remote_ack, header.ack);
+    }
+
+    // everything unacknowledged, or as much of it from the oldest as fits, since the peer can
+    // only take keys in order. an empty packet still carries the acknowledgement
+    const uint64_t first = std::min(remote_ack, session.Frame());
+    const uint64_t end = std::min<uint64_t>(session.Frame(), first + MAX_PACKET_INPUTS);
+    InputPacket header{NETPLAY_MAGIC, static_cast<uint32_t>(end - first), first, session.ConfirmedFrame()};
+    memcpy(buffer, &header, sizeof(header));
+    for (uint64_t frame = first; frame < end; frame++)
+    {
+        const uint16_t keys = session.LocalInput(frame);
+        memcpy(&buffer[sizeof(header) + (frame - first) * sizeof(uint16_t)], &keys, sizeof(keys));
+    }
+    link.Send(buffer, sizeof(header) + header.count * sizeof(uint16_t));
+    link.Flush();
+}
@@ -0,0 +1,85 @@
+#ifndef NETLINK_H
+#define NETLINK_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include "rollback.h"
+
+// BSD sockets, everywhere else UdpLink::Open() fails and there is no netplay
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_NETPLAY_SUPPORTED 1
+#else
+#define CHIP8_NETPLAY_SUPPORTED 0
+#endif
+
+struct LinkStats
+{
+    uint64_t sent;     // packets handed to Send()
+    uint64_t dropped;  // of those, thrown away by the simulated loss
+    uint64_t received; // packets Receive() returned
+};
+
+// a non-blocking UDP socket talking to one peer. SetFaults() makes it a worse network than
+// localhost: every packet sent is dropped with some probability, and the rest are held back
+// for a while before they actually go out
+class UdpLink
+{
+public:
+    UdpLink() = default;
+    UdpLink(UdpLink const &) = delete;
+    UdpLink &operator=(UdpLink const &) = delete;
+    ~UdpLink();
+
+    bool Open(uint16_t localPort, std::string const &remoteHost, uint16_t remotePort);
+    void SetFaults(uint32_t delayMs, double lossPercent, uint64_t seed);
+
+    void Send(void const *data, size_t size);
+    // the next packet that has arrived, 0 if there is none
+    size_t Receive(void *data, size_t capacity);
+    // puts out the delayed packets that are due, call often
+    void Flush();
+
+    LinkStats GetStats() const { return stats; }
+
+private:
+    struct Delayed
+    {
+        std::chrono::steady_clock::time_point due;
+        std::vector<uint8_t> bytes;
+    };
+
+    int socket_fd = -1;
+    std::chrono::milliseconds delay{0};
+    double loss = 0;
+    std::mt19937_64 fault_random;
+    std::deque<Delayed> delayed; // in due order, every packet gets the same delay
+    LinkStats stats{};
+
+    void SendNow(uint8_t const *data, size_t size);
+};
+
+// the input exchange of a RollbackSession over a UdpLink. every packet carries the local keys
+// from the first frame the peer hasn't acknowledged to the newest, and acknowledges the peer's
+// keys received so far, so a lost packet is made up for by the next one
+class NetplayPeer
+{
+public:
+    NetplayPeer(RollbackSession &session, UdpLink &link) : session(session), link(link) {}
+
+    // reads every packet that arrived into the session, then sends one
+    void Exchange();
+    // how many frames of local keys the peer has confirmed
+    uint64_t RemoteAck() const { return remote_ack; }
+
+private:
+    RollbackSession &session;
+    UdpLink &link;
+    uint64_t remote_ack = 0;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "chip8.h"
+#include "netlink.h"
+#include "rollback.h"
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+const int FRAMES_PER_SECOND = 60;
+const uint32_t INSTRUCTIONS_PER_FRAME = 10; // both sides have to run the same machine
+const uint64_t NETPLAY_SEED = 1;
+const uint32_t MAX_ROLLBACK = 8; // frames either side can run ahead of the other's keys
+
+// each player holds keys of their own half of the keypad (player 1 0-7, player 2 8-F) and
+// changes them every few frames, the same keys for the same frame on every run
+static uint16_t ScriptedKeys(int player, uint64_t frame)
+{
+    const uint64_t hash = MixRandom(static_cast<uint64_t>(player) << 32u ^ frame / 12);
+    return static_cast<uint16_t>((hash & 0xFFu) << (player == 2 ? 8u : 0u));
+}
+
+// FNV-1a over what the game can see: registers, stack, timers, RNG, screen and memory. both
+// players should end on the same value
+static uint32_t StateChecksum(Chip8 const &chip8)
+{
+    std::unique_ptr<Chip8Snapshot> snapshot = std::make_unique<Chip8Snapshot>();
+    chip8.SaveState(*snapshot);
+    Chip8State const &state = snapshot->state;
+
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](void const *data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ static_cast<uint8_t const *>(data)[i]) * 16777619u;
+        }
+    };
+    add(state.registers, sizeof(state.registers));
+    add(state.stack, sizeof(state.stack));
+    add(&state.index, sizeof(state.index));
+    add(&state.pc, sizeof(state.pc));
+    add(&state.sp, sizeof(state.sp));
+    add(&state.delay_timer, sizeof(state.delay_timer));
+    add(&state.sound_timer, sizeof(state.sound_timer));
+    add(&state.instruction_count, sizeof(state.instruction_count));
+    add(&state.random, sizeof(state.random));
+    add(state.video, sizeof(state.video));
+    add(state.memory, sizeof(state.memory));
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    // arguments are the ROM file, which player this is, the local port, where the other player
+    // is, how many frames to play, and optionally a delay and a loss rate to add to every packet
+    // sent. run one process per player, player 1 and player 2 pointing at each other's ports
+    if (argc < 7 || argc > 9 || (std::string(argv[2]) != "1" && std::string(argv[2]) != "2"))
+    {
+        std::cerr << "Usage: " << argv[0] << " [ROM File] [Player 1|2] [Local Port] [Remote Host] [Remote Port] [Frames] [Delay ms] [Loss %]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    const int player = std::stoi(argv[2]);
+    const uint64_t frames = std::stoull(argv[6]);
+    const uint32_t delayMs = argc > 7 ? std::stoul(argv[7]) : 0;
+    const double lossPercent = argc > 8 ? std::stod(argv[8]) : 0;
+
+    Chip8 chip8(DispatchMode::Predecoded);
+    chip8.LoadRom(argv[1]);
+    chip8.SetSeed(NETPLAY_SEED);
+    chip8.SetInstructionsPerFrame(INSTRUCTIONS_PER_FRAME);
+    RollbackSession session(chip8, MAX_ROLLBACK);
+
+    UdpLink link;
+    if (!link.Open(static_cast<uint16_t>(std::stoul(argv[3])), argv[4], static_cast<uint16_t>(std::stoul(argv[5]))))
+    {
+        std::cerr << "Could not open a UDP socket on port " << argv[3] << " to " << argv[4] << ":" << argv[5] << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    link.SetFaults(delayMs, lossPercent, player);
+    NetplayPeer peer(session, link);
+
+    // 60 frames a second, a frame the session refuses (the other player is too far behind) is
+    // tried again on the next tick
+    const auto framePeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / FRAMES_PER_SECOND));
+    const auto startTime = std::chrono::steady_clock::now();
+    auto nextFrame = startTime + framePeriod;
+    while (session.Frame() < frames)
+    {
+        peer.Exchange();
+        session.AdvanceFrame(ScriptedKeys(player, session.Frame()));
+        peer.Exchange();
+        std::this_thread::sleep_until(nextFrame);
+        nextFrame += framePeriod;
+    }
+    const double playSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    // the last keys still have to go both ways. the other player may be gone once it has
+    // everything, so give up after a while without hearing from it
+    auto lastHeard = std::chrono::steady_clock::now();
+    uint64_t received = link.GetStats().received;
+    while (session.ConfirmedFrame() < frames || peer.RemoteAck() < frames)
+    {
+        peer.Exchange();
+        if (link.GetStats().received != received)
+        {
+            received = link.GetStats().received;
+            lastHeard = std::chrono::steady_clock::now();
+        }
+        else if (std::chrono::steady_clock::now() - lastHeard > std::chrono::seconds(2))
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    session.Resimulate();
+
+    const RollbackStats stats = session.GetStats();
+    const LinkStats linkStats = link.GetStats();
+    const bool confirmed = session.ConfirmedFrame() >= frames;
+    std::cerr << "player:             " << player << "\n"
+              << "frames:             " << stats.frames << " in " << playSeconds << " s\n"
+              << "stalls:             " << stats.stalls << "\n"
+              << "mispredictions:     " << stats.mispredictions << "\n"
+              << "rollbacks:          " << stats.rollbacks << "\n"
+              << "rollback depth:     " << (stats.rollbacks ? static_cast<double>(stats.resimulated) / stats.rollbacks : 0) << " avg, " << stats.max_depth << " max\n"
+              << "resimulated frames: " << stats.resimulated << "\n"
+              << "resimulation ms:    " << stats.resimulate_ms << " total, " << (stats.rollbacks ? stats.resimulate_ms / stats.rollbacks : 0) << " avg, " << stats.max_resimulate_ms << " max\n"
+              << "packets:            " << linkStats.sent << " sent, " << linkStats.dropped << " dropped, " << linkStats.received << " received\n"
+              << "state hash:         " << std::hex << StateChecksum(chip8) << std::dec << (confirmed ? "" : " (unconfirmed)") << std::endl;
+
+    return confirmed ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+#include "paged.h"
+#include <cstring>
+
+void PageRef::Store(uint8_t const *bytes)
+{
+    if (!page || page->refs > 1)
+    {
+        Release();
+        page = new MemoryPage;
+        page->refs = 1;
+    }
+    memcpy(page->bytes, bytes, PAGE_SIZE);
+}
+
+void PageRef::Release()
+{
+    if (page && --page->refs == 0)
+    {
+        delete page;
+    }
+    page = nullptr;
+}
@@ -0,0 +1,68 @@
+#ifndef PAGED_H
+#define PAGED_H
+
+#include <cstdint>
+
+// memory split into pages for SaveState(PagedState &). a saved state shares each page with the
+// machine and with every other state until the machine writes to it, then the next save copies
+// only the pages that were written
+const int PAGE_SIZE = 256;
+const int PAGE_COUNT = 4096 / PAGE_SIZE;
+
+struct MemoryPage
+{
+    uint32_t refs;
+    uint8_t bytes[PAGE_SIZE];
+};
+
+// a counted reference to a MemoryPage, null until Store() is called. the count isn't atomic, so
+// states forked from one machine have to stay on that machine's thread
+class PageRef
+{
+public:
+    PageRef() = default;
+    PageRef(PageRef const &other) : page(other.page) { Retain(); }
+    PageRef &operator=(PageRef const &other)
+    {
+        if (page != other.page)
+        {
+            Release();
+            page = other.page;
+            Retain();
+        }
+        return *this;
+    }
+    ~PageRef() { Release(); }
+
+    // replaces the contents with a copy of PAGE_SIZE bytes. a page nobody else holds is
+    // overwritten in place, a shared one is left to its other holders
+    void Store(uint8_t const *bytes);
+
+    uint8_t const *Bytes() const { return page->bytes; }
+    explicit operator bool() const { return page != nullptr; }
+    bool operator==(PageRef const &other) const { return page == other.page; }
+    bool operator!=(PageRef const &other) const { return page != other.page; }
+
+private:
+    MemoryPage *page = nullptr;
+
+    void Retain()
+    {
+        if (page)
+        {
+            ++page->refs;
+        }
+    }
+    void Release();
+};
+
+// what SaveState(PagedState &) and LoadState(PagedState const &) have done
+struct ForkStats
+{
+    uint64_t saves;
+    uint64_t pages_copied; // pages written since the last save or load, pages_copied / saves is pages per fork
+    uint64_t loads;
+    uint64_t pages_loaded; // pages whose contents differed from the machine's
+};
+
+#endif
@@ -0,0 +1,314 @@
+#include "recording.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#if CHIP8_RECORDING_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint32_t RECORDING_MAGIC = 0x4E493843u; // "C8IN" in a little endian file
+const uint32_t RECORDING_VERSION = 3;
+
+// the file is this header, event_count RecordedEvents, keyframe_count KeyframeEntries, then
+// at keyframes_offset the Chip8Snapshots themselves, everything written as it is in memory. the
+// index is small and sorted, so finding a keyframe doesn't touch the others
+struct RecordingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;
+    uint64_t length;
+    uint64_t keyframe_interval;
+    uint32_t instructions_per_frame;
+    uint32_t event_count;
+    uint32_t keyframe_count;
+    uint32_t reserved;
+    uint64_t keyframes_offset; // a multiple of alignof(Chip8Snapshot), so the mapping can be used as is
+};
+
+struct RecordedEvent
+{
+    uint64_t instruction;
+    uint64_t keys;
+};
+
+struct KeyframeEntry
+{
+    uint64_t instruction;
+    uint64_t offset;
+};
+
+static uint16_t KeyMask(Chip8 const &chip8)
+{
+    uint16_t keys = 0;
+    for (int key = 0; key < 16; key++)
+    {
+        keys |= (chip8.keypad[key] != 0) << key;
+    }
+    return keys;
+}
+
+static void SetKeys(Chip8 &chip8, uint16_t keys)
+{
+    for (int key = 0; key < 16; key++)
+    {
+        chip8.keypad[key] = (keys >> key) & 1u;
+    }
+}
+
+// runs from the machine's instruction count to 'until', applying the keypad changes on the way.
+// the keypad only changes between Run() calls, so each call runs up to the next event exactly.
+// the events at 'until' itself are applied too, the recorder saw them before the next instruction
+template <typename Event>
+static void RunEvents(Chip8 &chip8, Event const *events, size_t count, uint64_t until)
+{
+    uint64_t now = chip8.GetInstructionCount();
+    size_t next = std::lower_bound(events, events + count, now, [](Event const &event, uint64_t at)
+                                   { return event.instruction < at; }) -
+                  events;
+    for (;;)
+    {
+        while (next < count && events[next].instruction <= now)
+        {
+            SetKeys(chip8, static_cast<uint16_t>(events[next++].keys));
+        }
+        if (now >= until)
+        {
+            break;
+        }
+
+        const uint64_t stop = next < count ? std::min<uint64_t>(events[next].instruction, until) : until;
+        chip8.Run(static_cast<uint32_t>(std::min<uint64_t>(stop - now, UINT32_MAX)));
+        now = chip8.GetInstructionCount();
+    }
+}
+
+bool InputRecording::Save(std::string const &filename) const
+{
+    const size_t index_end = sizeof(RecordingHeader) + events.size() * sizeof(RecordedEvent) + keyframes.size() * sizeof(KeyframeEntry);
+    const size_t keyframes_offset = (index_end + alignof(Chip8Snapshot) - 1) / alignof(Chip8Snapshot) * alignof(Chip8Snapshot);
+
+    std::ofstream file(filename, std::ios::binary);
+    RecordingHeader header{RECORDING_MAGIC, RECORDING_VERSION, seed, length, keyframe_interval, instructions_per_frame,
+                           static_cast<uint32_t>(events.size()), static_cast<uint32_t>(keyframes.size()), 0, keyframes_offset};
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    for (InputEvent const &event : events)
+    {
+        RecordedEvent recorded{event.instruction, event.keys};
+        file.write(reinterpret_cast<char const *>(&recorded), sizeof(recorded));
+    }
+    for (size_t i = 0; i < keyframes.size(); i++)
+    {
+        KeyframeEntry entry{keyframes[i].state.instruction_count, keyframes_offset + i * sizeof(Chip8Snapshot)};
+        file.write(reinterpret_cast<char const *>(&entry), sizeof(entry));
+    }
+    const char padding[alignof(Chip8Snapshot)] = {};
+    file.write(padding, keyframes_offset - index_end);
+    file.write(reinterpret_cast<char const *>(keyframes.data()), keyframes.size() * sizeof(Chip8Snapshot));
+    return static_cast<bool>(file);
+}
+
+InputRecorder::InputRecorder(Chip8 &chip8, uint64_t seed, uint32_t instructionsPerFrame, uint32_t keyframeFrames)
+{
+    recording.seed = seed;
+    recording.instructions_per_frame = instructionsPerFrame;
+    recording.keyframe_interval = static_cast<uint64_t>(std::max<uint32_t>(keyframeFrames, 1)) * instructionsPerFrame;
+    chip8.SetSeed(seed);
+    chip8.SetInstructionsPerFrame(instructionsPerFrame);
+}
+
+void InputRecorder::Record(Chip8 const &chip8)
+{
+    const uint64_t now = chip8.GetInstructionCount();
+    std::vector<InputEvent> &events = recording.events;
+    std::vector<Chip8Snapshot> &keyframes = recording.keyframes;
+    if (!events.empty() && events.back().instruction > now)
+    {
+        // everything after 'now' never happened as far as the machine is concerned
+        while (!events.empty() && events.back().instruction > now)
+        {
+            events.pop_back();
+        }
+        keys = events.empty() ? 0 : events.back().keys;
+    }
+    while (!keyframes.empty() && keyframes.back().state.instruction_count > now)
+    {
+        keyframes.pop_back();
+    }
+
+    const uint16_t current = KeyMask(chip8);
+    if (current != keys)
+    {
+        keys = current;
+        if (!events.empty() && events.back().instruction == now)
+        {
+            events.back().keys = current; // two changes between the same two instructions
+        }
+        else
+        {
+            events.push_back({now, current});
+        }
+    }
+
+    // after the event, so a keyframe's keypad already has it
+    if (keyframes.empty() || now >= keyframes.back().state.instruction_count + recording.keyframe_interval)
+    {
+        keyframes.emplace_back();
+        chip8.SaveState(keyframes.back());
+    }
+}
+
+InputRecording const &InputRecorder::Finish(Chip8 const &chip8)
+{
+    recording.length = chip8.GetInstructionCount();
+    return recording;
+}
+
+void Replay(Chip8 &chip8, InputRecording const &recording)
+{
+    chip8.SetSeed(recording.seed);
+    chip8.SetInstructionsPerFrame(recording.instructions_per_frame);
+    RunEvents(chip8, recording.events.data(), recording.events.size(), recording.length);
+}
+
+RecordingFile::~RecordingFile()
+{
+    Close();
+}
+
+void RecordingFile::Close()
+{
+#if CHIP8_RECORDING_MMAP
+    if (data)
+    {
+        munmap(const_cast<uint8_t *>(data), size);
+    }
+#else
+    contents.clear();
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+// false if the file can't be read or its header doesn't add up
+bool RecordingFile::Open(std::string const &filename)
+{
+    Close();
+
+#if CHIP8_RECORDING_MMAP
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(sizeof(RecordingHeader)))
+    {
+        void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            data = static_cast<uint8_t const *>(mapped);
+            size = info.st_size;
+        }
+    }
+    close(fd);
+#else
+    std::ifstream file(filename, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (contents.size() >= sizeof(RecordingHeader))
+    {
+        data = contents.data();
+        size = contents.size();
+    }
+#endif
+    if (!data)
+    {
+        return false;
+    }
+
+    // the counts are 32 bits, so none of these products can overflow 64 bits. the offset comes
+    // straight from the file though, so it's checked against the size before anything is added to it
+    RecordingHeader const &header = *reinterpret_cast<RecordingHeader const *>(data);
+    const uint64_t index_end = sizeof(RecordingHeader) + static_cast<uint64_t>(header.event_count) * sizeof(RecordedEvent) + static_cast<uint64_t>(header.keyframe_count) * sizeof(KeyframeEntry);
+    const uint64_t keyframes_size = static_cast<uint64_t>(header.keyframe_count) * sizeof(Chip8Snapshot);
+    const bool valid = header.magic == RECORDING_MAGIC && header.version == RECORDING_VERSION && header.keyframes_offset >= index_end &&
+                       header.keyframes_offset % alignof(Chip8Snapshot) == 0 && header.keyframes_offset <= size &&
+                       keyframes_size <= size - header.keyframes_offset;
+    if (!valid)
+    {
+        Close();
+    }
+    return valid;
+}
+
+uint64_t RecordingFile::Seed() const
+{
+    return reinterpret_cast<RecordingHeader const *>(data)->seed;
+}
+
+uint32_t RecordingFile::InstructionsPerFrame() const
+{
+    return reinterpret_cast<RecordingHeader const *>(data)->instructions_per_frame;
+}
+
+uint64_t RecordingFile::Length() const
+{
+    return reinterpret_cast<RecordingHeader const *>(data)->length;
+}
+
+size_t RecordingFile::EventCount() const
+{
+    return reinterpret_cast<RecordingHeader const *>(data)->event_count;
+}
+
+size_t RecordingFile::KeyframeCount() const
+{
+    return reinterpret_cast<RecordingHeader const *>(data)->keyframe_count;
+}
+
+void RecordingFile::Replay(Chip8 &chip8) const
+{
+    RecordedEvent const *events = reinterpret_cast<RecordedEvent const *>(data + sizeof(RecordingHeader));
+    chip8.SetSeed(Seed());
+    chip8.SetInstructionsPerFrame(InstructionsPerFrame());
+    RunEvents(chip8, events, EventCount(), Length());
+}
+
+bool RecordingFile::Seek(Chip8 &chip8, uint64_t instruction) const
+{
+    if (instruction > Length() || KeyframeCount() == 0)
+    {
+        return false;
+    }
+
+    // the last keyframe at or before the target, the recorder always takes one at the start
+    RecordedEvent const *events = reinterpret_cast<RecordedEvent const *>(data + sizeof(RecordingHeader));
+    KeyframeEntry const *index = reinterpret_cast<KeyframeEntry const *>(events + EventCount());
+    KeyframeEntry const *entry = std::upper_bound(index, index + KeyframeCount(), instruction, [](uint64_t at, KeyframeEntry const &keyframe)
+                                                  { return at < keyframe.instruction; });
+    if (entry == index)
+    {
+        return false;
+    }
+    --entry;
+
+    // the snapshots are stored in index order, so the address follows from the entry's position.
+    // entry->offset isn't trusted, Open() only checked the keyframes as a whole
+    RecordingHeader const &header = *reinterpret_cast<RecordingHeader const *>(data);
+    Chip8Snapshot const *keyframes = reinterpret_cast<Chip8Snapshot const *>(data + header.keyframes_offset);
+    if (!chip8.LoadState(keyframes[entry - index]))
+    {
+        return false;
+    }
+    RunEvents(chip8, events, EventCount(), instruction);
+    return true;
+}
+
+bool RecordingFile::SeekFrame(Chip8 &chip8, uint64_t frame) const
+{
+    return Seek(chip8, frame * InstructionsPerFrame());
+}
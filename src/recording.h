@@ -0,0 +1,96 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+// mapped with mmap where there is one, elsewhere RecordingFile reads the whole file instead
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_RECORDING_MMAP 1
+#else
+#define CHIP8_RECORDING_MMAP 0
+#endif
+
+// a keypad change, keyed by the instruction count it happened at
+struct InputEvent
+{
+    uint64_t instruction;
+    uint16_t keys; // bit k set means key k is down
+};
+
+// everything a session depends on besides the ROM: the seed, the frame length and the keypad
+// changes. a fresh Chip8 with the same ROM replays it exactly. the keyframes are full states
+// taken every keyframe_interval instructions, so a RecordingFile can seek without replaying
+// from the start
+struct InputRecording
+{
+    uint64_t seed = 0;
+    uint32_t instructions_per_frame = 0;
+    uint64_t length = 0; // instruction count at the end of the session
+    uint64_t keyframe_interval = 0;
+    std::vector<InputEvent> events;
+    std::vector<Chip8Snapshot> keyframes; // in instruction order
+
+    bool Save(std::string const &filename) const;
+};
+
+// builds an InputRecording from a running session. the seed and frame length are set on the
+// Chip8 here, so the recorder has to be created before the first instruction runs
+class InputRecorder
+{
+public:
+    InputRecorder(Chip8 &chip8, uint64_t seed, uint32_t instructionsPerFrame, uint32_t keyframeFrames = 600);
+
+    // logs the keypad if it changed and takes a keyframe when one is due, call after every
+    // input update. if the instruction count went backwards (the state was rewound or loaded)
+    // the events and keyframes after it are dropped first
+    void Record(Chip8 const &chip8);
+    // stamps the length, the recording ends at the machine's current instruction count
+    InputRecording const &Finish(Chip8 const &chip8);
+
+private:
+    InputRecording recording;
+    uint16_t keys = 0;
+};
+
+// runs a fresh Chip8 (ROM loaded, nothing run yet) through the whole recording, unthrottled
+void Replay(Chip8 &chip8, InputRecording const &recording);
+
+// a saved recording, opened without reading it: the header is checked and the rest is only
+// touched as Replay() and Seek() need it
+class RecordingFile
+{
+public:
+    RecordingFile() = default;
+    RecordingFile(RecordingFile const &) = delete;
+    RecordingFile &operator=(RecordingFile const &) = delete;
+    ~RecordingFile();
+
+    bool Open(std::string const &filename);
+
+    uint64_t Seed() const;
+    uint32_t InstructionsPerFrame() const;
+    uint64_t Length() const;
+    size_t EventCount() const;
+    size_t KeyframeCount() const;
+
+    // runs a fresh Chip8 through the whole recording, like Replay() above
+    void Replay(Chip8 &chip8) const;
+    // puts chip8 (ROM loaded) in the state it had after 'instruction' instructions: the
+    // nearest keyframe at or before it, then the events up to it. false if it is past the end
+    bool Seek(Chip8 &chip8, uint64_t instruction) const;
+    bool SeekFrame(Chip8 &chip8, uint64_t frame) const;
+
+private:
+    uint8_t const *data = nullptr;
+    size_t size = 0;
+#if !CHIP8_RECORDING_MMAP
+    std::vector<uint8_t> contents;
+#endif
+    void Close();
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "chip8.h"
+#include "recording.h"
+#include <iostream>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// FNV-1a hash of the video buffer, the same as chip8-headless prints
+static uint32_t VideoChecksum(const Chip8 &chip8)
+{
+    uint32_t hash = 2166136261u;
+    for (int y = 0; y < 32; y++)
+    {
+        const uint64_t row = chip8.GetVideo()[y];
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            hash = (hash ^ ((row >> shift) & 0xFFu)) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    // arguments are the ROM file, a recording made by the SDL frontend, how many times to replay
+    // it and an optional dispatch mode
+    DispatchMode dispatchMode = DispatchMode::Predecoded;
+    if (argc < 4 || argc > 5 || (argc == 5 && !ParseDispatchMode(argv[4], dispatchMode)))
+    {
+        std::cerr << "Usage: " << argv[0] << " [ROM File] [Recording File] [Times] [table|flat|switch|threaded|predecoded|block|jit|fused]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const auto openStart = std::chrono::high_resolution_clock::now();
+    RecordingFile recording;
+    if (!recording.Open(argv[2]))
+    {
+        std::cerr << "Could not read recording " << argv[2] << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    const double openSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - openStart).count();
+    long times = std::stol(argv[3]);
+
+    // every replay has to end on the same screen, otherwise something isn't deterministic
+    uint32_t firstHash = 0;
+    long mismatches = 0;
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    for (long replay = 0; replay < times; replay++)
+    {
+        Chip8 chip8(dispatchMode);
+        chip8.LoadRom(rom.data(), rom.size());
+        recording.Replay(chip8);
+
+        const uint32_t hash = VideoChecksum(chip8);
+        if (replay == 0)
+        {
+            firstHash = hash;
+        }
+        else if (hash != firstHash)
+        {
+            ++mismatches;
+        }
+    }
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+    double instructions = static_cast<double>(recording.Length()) * times;
+
+    // seeking to a frame restores the keyframe before it and replays the rest, so it costs at
+    // most a keyframe interval wherever it lands. seeking to the end has to agree with the replays
+    const int SEEKS = 100;
+    Chip8 seeker(dispatchMode);
+    seeker.LoadRom(rom.data(), rom.size());
+    const uint64_t frames = recording.InstructionsPerFrame() ? recording.Length() / recording.InstructionsPerFrame() : 0;
+    std::mt19937_64 targets(recording.Seed());
+    const auto seekStart = std::chrono::high_resolution_clock::now();
+    for (int seek = 0; seek < SEEKS; seek++)
+    {
+        recording.SeekFrame(seeker, frames ? targets() % (frames + 1) : 0);
+    }
+    const double seekSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - seekStart).count();
+    if (times > 0 && (!recording.Seek(seeker, recording.Length()) || VideoChecksum(seeker) != firstHash))
+    {
+        ++mismatches;
+    }
+
+    std::cerr << "replays:      " << times << "\n"
+              << "events:       " << recording.EventCount() << "\n"
+              << "keyframes:    " << recording.KeyframeCount() << "\n"
+              << "open us:      " << openSeconds * 1e6 << "\n"
+              << "seek us:      " << seekSeconds * 1e6 / SEEKS << "\n"
+              << "instructions: " << static_cast<long long>(instructions) << "\n"
+              << "seconds:      " << seconds << "\n"
+              << "replays/s:    " << (seconds > 0 ? times / seconds : 0) << "\n"
+              << "ips:          " << (seconds > 0 ? instructions / seconds : 0) << "\n"
+              << "video hash:   " << std::hex << firstHash << std::dec << "\n"
+              << "mismatches:   " << mismatches << std::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
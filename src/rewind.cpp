@@ -0,0 +1,229 @@
+#include "rewind.h"
+#include <algorithm>
+#include <cstring>
+
+static_assert(sizeof(Chip8Snapshot) <= 0xFFFF, "run lengths are stored as 16 bits");
+
+// a keyframe is stored against all zeros, which is just its bytes with the runs of zeros removed
+static const uint8_t ZERO_STATE[sizeof(Chip8Snapshot)] = {};
+
+static void PutRun(std::vector<uint8_t> &out, size_t length)
+{
+    out.push_back(static_cast<uint8_t>(length));
+    out.push_back(static_cast<uint8_t>(length >> 8u));
+}
+
+static size_t GetRun(uint8_t const *in)
+{
+    return in[0] | (in[1] << 8u);
+}
+
+// writes state XOR reference as pairs of run lengths, zeros to skip then bytes to XOR in,
+// followed by those bytes. a literal run only ends at four or more zeros in a row, shorter gaps
+// cost less to keep than to start a new pair for
+static void Encode(uint8_t const *state, uint8_t const *reference, size_t size, std::vector<uint8_t> &out)
+{
+    out.clear();
+    size_t i = 0;
+    while (i < size)
+    {
+        // equal bytes, eight at a time while possible
+        const size_t zeros_start = i;
+        while (i + 8 <= size && memcmp(&state[i], &reference[i], 8) == 0)
+        {
+            i += 8;
+        }
+        while (i < size && state[i] == reference[i])
+        {
+            i++;
+        }
+        if (i == size)
+        {
+            break; // trailing zeros need no pair
+        }
+
+        const size_t literal_start = i;
+        size_t equal = 0;
+        while (i < size && equal < 4)
+        {
+            equal = state[i] == reference[i] ? equal + 1 : 0;
+            i++;
+        }
+        if (equal > 0)
+        {
+            i -= equal; // the zeros that ended the run start the next pair
+        }
+
+        PutRun(out, literal_start - zeros_start);
+        PutRun(out, i - literal_start);
+        for (size_t j = literal_start; j < i; j++)
+        {
+            out.push_back(state[j] ^ reference[j]);
+        }
+    }
+}
+
+static void Decode(uint8_t const *in, size_t length, uint8_t const *reference, size_t size, uint8_t *state)
+{
+    memcpy(state, reference, size);
+    uint8_t const *end = in + length;
+    size_t i = 0;
+    while (in < end)
+    {
+        i += GetRun(in);
+        const size_t literal = GetRun(in + 2);
+        in += 4;
+        for (size_t j = 0; j < literal; j++)
+        {
+            state[i + j] ^= in[j];
+        }
+        i += literal;
+        in += literal;
+    }
+}
+
+// the ring has to fit at least a keyframe that didn't compress at all
+RewindBuffer::RewindBuffer(size_t maxFrames, size_t maxBytes, uint32_t keyframeInterval)
+    : capacity(std::max(maxBytes, 2 * sizeof(Chip8Snapshot))), max_frames(std::max<size_t>(maxFrames, 2)),
+      keyframe_interval(std::max<uint32_t>(keyframeInterval, 1)), snapshot(std::make_unique<Chip8Snapshot>()),
+      push_key(std::make_unique<Chip8Snapshot>()), rewind_key(std::make_unique<Chip8Snapshot>())
+{
+    data.reset(new uint8_t[capacity]);
+    packed.reserve(sizeof(Chip8Snapshot) * 2);
+}
+
+void RewindBuffer::Push(Chip8 const &chip8)
+{
+    chip8.SaveState(*snapshot);
+    uint8_t const *state = reinterpret_cast<uint8_t const *>(snapshot.get());
+
+    bool keyframe = entries.empty() || since_keyframe >= keyframe_interval;
+    for (;;)
+    {
+        Encode(state, keyframe ? ZERO_STATE : reinterpret_cast<uint8_t const *>(push_key.get()), sizeof(Chip8Snapshot), packed);
+        while (entries.size() >= max_frames)
+        {
+            DropOldest();
+        }
+        uint8_t *destination = Allocate(packed.size());
+
+        // making room can take the keyframe this frame was stored against, then it has to
+        // become a keyframe itself
+        if (!keyframe && push_key_offset == SIZE_MAX)
+        {
+            head = destination - data.get();
+            keyframe = true;
+            continue;
+        }
+
+        memcpy(destination, packed.data(), packed.size());
+        entries.push_back({static_cast<size_t>(destination - data.get()), static_cast<uint32_t>(packed.size()), keyframe});
+        used_bytes += packed.size();
+        break;
+    }
+
+    if (keyframe)
+    {
+        *push_key = *snapshot;
+        push_key_offset = entries.back().offset;
+        since_keyframe = 0;
+    }
+    since_keyframe++;
+}
+
+bool RewindBuffer::Rewind(Chip8 &chip8)
+{
+    if (entries.size() < 2)
+    {
+        return false;
+    }
+
+    if (entries.back().keyframe && entries.back().offset == rewind_key_offset)
+    {
+        rewind_key_offset = SIZE_MAX;
+    }
+    used_bytes -= entries.back().size;
+    head = entries.back().offset;
+    entries.pop_back();
+
+    // the newest frame left, and the keyframe it was stored against
+    size_t key = entries.size() - 1;
+    while (!entries[key].keyframe)
+    {
+        key--;
+    }
+    Entry const &keyframe = entries[key];
+    if (keyframe.offset != rewind_key_offset)
+    {
+        Decode(&data[keyframe.offset], keyframe.size, ZERO_STATE, sizeof(Chip8Snapshot), reinterpret_cast<uint8_t *>(rewind_key.get()));
+        rewind_key_offset = keyframe.offset;
+    }
+
+    Entry const &newest = entries.back();
+    if (newest.keyframe)
+    {
+        *snapshot = *rewind_key;
+    }
+    else
+    {
+        Decode(&data[newest.offset], newest.size, reinterpret_cast<uint8_t const *>(rewind_key.get()), sizeof(Chip8Snapshot), reinterpret_cast<uint8_t *>(snapshot.get()));
+    }
+
+    uint8_t keypad[16];
+    memcpy(keypad, chip8.keypad, sizeof(keypad));
+    chip8.LoadState(*snapshot);
+    memcpy(chip8.keypad, keypad, sizeof(keypad));
+
+    // the next Push() starts a fresh keyframe rather than working out which one is current
+    since_keyframe = keyframe_interval;
+    return true;
+}
+
+// room for 'size' bytes at head, wrapping to the start of the ring if they don't fit before the
+// end, and dropping whatever old frames are in the way
+uint8_t *RewindBuffer::Allocate(size_t size)
+{
+    // entries lie in ring order from the oldest. past the end of the ring, the ones between
+    // head and the end are the oldest and go first, then the oldest is the one at the start
+    if (head + size > capacity)
+    {
+        while (!entries.empty() && entries.front().offset >= head)
+        {
+            DropOldest();
+        }
+        head = 0;
+    }
+
+    while (!entries.empty())
+    {
+        Entry const &oldest = entries.front();
+        const bool overlaps = oldest.offset < head + size && head < oldest.offset + oldest.size;
+        if (!overlaps)
+        {
+            break;
+        }
+        DropOldest();
+    }
+
+    uint8_t *destination = &data[head];
+    head += size;
+    return destination;
+}
+
+// drops the oldest keyframe and the frames stored against it
+void RewindBuffer::DropOldest()
+{
+    do
+    {
+        if (entries.front().keyframe && entries.front().offset == rewind_key_offset)
+        {
+            rewind_key_offset = SIZE_MAX;
+        }
+        if (entries.front().keyframe && entries.front().offset == push_key_offset)
+        {
+            push_key_offset = SIZE_MAX;
+        }
+        used_bytes -= entries.front().size;
+        entries.pop_front();
+    } while (!entries.empty() && !entries.front().keyframe);
+}
@@ -0,0 +1,60 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "chip8.h"
+
+// the last frames of a Chip8, one snapshot per Push(), kept in a fixed-size ring of bytes. every
+// keyframe_interval frames a keyframe is stored whole, the frames between store only the bytes
+// that differ from their keyframe: the XOR of the two states with the runs of zeros squeezed out.
+// when the ring or the frame limit is full the oldest keyframe goes, with the frames that need it
+class RewindBuffer
+{
+public:
+    RewindBuffer(size_t maxFrames, size_t maxBytes, uint32_t keyframeInterval = 60);
+
+    // stores the machine as the newest frame
+    void Push(Chip8 const &chip8);
+    // drops the newest frame and puts the machine back to the one before it, false (and the
+    // machine left alone) if there is nothing older. the keypad is the host's input right now
+    // rather than history, so it's kept
+    bool Rewind(Chip8 &chip8);
+
+    size_t Frames() const { return entries.size(); }
+    size_t Bytes() const { return used_bytes; }
+
+private:
+    struct Entry
+    {
+        size_t offset; // into data
+        uint32_t size;
+        bool keyframe;
+    };
+
+    std::unique_ptr<uint8_t[]> data;
+    size_t capacity;
+    size_t head = 0; // where the next entry goes
+    size_t used_bytes = 0;
+    size_t max_frames;
+    uint32_t keyframe_interval;
+    uint32_t since_keyframe = 0; // frames pushed since the newest keyframe
+
+    std::deque<Entry> entries; // oldest first, always starting with a keyframe
+
+    // scratch space, kept so Push() and Rewind() don't allocate
+    std::unique_ptr<Chip8Snapshot> snapshot;
+    std::unique_ptr<Chip8Snapshot> push_key;   // the keyframe new frames are stored against
+    size_t push_key_offset = SIZE_MAX;         // its entry, SIZE_MAX once dropped
+    std::unique_ptr<Chip8Snapshot> rewind_key; // decoded keyframe of rewind_key_offset
+    size_t rewind_key_offset = SIZE_MAX;
+    std::vector<uint8_t> packed;
+
+    uint8_t *Allocate(size_t size);
+    void DropOldest();
+};
+
+#endif
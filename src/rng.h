@@ -0,0 +1,42 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// everything Cxkk's random numbers depend on. it's part of Chip8Core, so a snapshot, a rewind
+// or a fork carries the generator along with the rest of the machine
+struct RandomState
+{
+    uint64_t key;     // picks the stream, from the seed and the instance
+    uint64_t counter; // how many numbers the stream has given so far
+};
+
+// returns the next byte for Cxkk and advances state. a source has to keep all of its state in
+// RandomState, anything kept elsewhere isn't saved or replayed
+typedef uint8_t (*RandomSource)(RandomState &state);
+
+// the SplitMix64 finaliser, a bijection on 64 bits
+inline uint64_t MixRandom(uint64_t z)
+{
+    z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31u);
+}
+
+// the stream for one machine of a batch. the same (seed, instance) always gives the same bytes,
+// whatever the platform or standard library, and different instances don't overlap
+inline RandomState SeedRandom(uint64_t seed, uint64_t instance = 0)
+{
+    return RandomState{MixRandom(seed ^ MixRandom(instance + 0x9E3779B97F4A7C15ull)), 0};
+}
+
+// the default source, counter based: number n of a stream is a hash of (key, n), so there's no
+// state to step through and any position can be computed directly. mixing the key in between two
+// rounds keeps one stream from being a shifted copy of another
+inline uint8_t CounterRandom(RandomState &state)
+{
+    const uint64_t block = MixRandom(MixRandom(state.counter++) ^ state.key);
+    return static_cast<uint8_t>(block >> 56u);
+}
+
+#endif
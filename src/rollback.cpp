@@ -0,0 +1,95 @@
+#include "rollback.h"
+#include <algorithm>
+#include <chrono>
+
+RollbackSession::RollbackSession(Chip8 &chip8, uint32_t maxRollback)
+    : chip8(chip8), max_rollback(std::max<uint32_t>(maxRollback, 1)), snapshots(new Chip8Snapshot[max_rollback + 1]),
+      used_remote(new uint16_t[max_rollback + 1])
+{
+}
+
+// known, or predicted as the last keys that are
+uint16_t RollbackSession::RemoteInput(uint64_t frame) const
+{
+    if (frame < remote_inputs.size())
+    {
+        return remote_inputs[frame];
+    }
+    return remote_inputs.empty() ? 0 : remote_inputs.back();
+}
+
+// saves the state before 'frame' and runs it. the keys are kept alongside so a late input can
+// be checked against what was actually used
+void RollbackSession::RunFrame(uint64_t frame)
+{
+    const size_t slot = frame % (max_rollback + 1);
+    chip8.SaveState(snapshots[slot]);
+    used_remote[slot] = RemoteInput(frame);
+
+    const uint16_t keys = local_inputs[frame] | used_remote[slot];
+    for (int key = 0; key < 16; key++)
+    {
+        chip8.keypad[key] = (keys >> key) & 1u;
+    }
+    while (!chip8.RunFrame().frame_complete)
+    {
+    }
+}
+
+bool RollbackSession::AdvanceFrame(uint16_t localKeys)
+{
+    Resimulate();
+    // the oldest unconfirmed frame's snapshot would be overwritten. the remote player can also
+    // be ahead, then nothing is predicted
+    if (Frame() >= ConfirmedFrame() + max_rollback)
+    {
+        stats.stalls++;
+        return false;
+    }
+
+    local_inputs.push_back(localKeys);
+    RunFrame(Frame() - 1);
+    stats.frames++;
+    return true;
+}
+
+void RollbackSession::AddRemoteInput(uint64_t frame, uint16_t keys)
+{
+    if (frame != remote_inputs.size())
+    {
+        return;
+    }
+    remote_inputs.push_back(keys);
+
+    // a frame that already ran with other keys, and so did everything after it
+    if (frame < Frame() && used_remote[frame % (max_rollback + 1)] != keys)
+    {
+        stats.mispredictions++;
+        resimulate_from = std::min(resimulate_from, frame);
+    }
+}
+
+void RollbackSession::Resimulate()
+{
+    if (resimulate_from == UINT64_MAX)
+    {
+        return;
+    }
+
+    const auto startTime = std::chrono::steady_clock::now();
+    const uint64_t from = resimulate_from;
+    resimulate_from = UINT64_MAX;
+    chip8.LoadState(snapshots[from % (max_rollback + 1)]);
+    for (uint64_t frame = from; frame < Frame(); frame++)
+    {
+        RunFrame(frame);
+    }
+
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    const uint64_t depth = Frame() - from;
+    stats.rollbacks++;
+    stats.resimulated += depth;
+    stats.max_depth = std::max(stats.max_depth, depth);
+    stats.resimulate_ms += ms;
+    stats.max_resimulate_ms = std::max(stats.max_resimulate_ms, ms);
+}
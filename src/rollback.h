@@ -0,0 +1,65 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "chip8.h"
+
+// what a RollbackSession has had to redo
+struct RollbackStats
+{
+    uint64_t frames;         // frames advanced, not counting re-simulation
+    uint64_t stalls;         // AdvanceFrame calls refused because the prediction window was full
+    uint64_t mispredictions; // frames whose predicted remote keys turned out wrong
+    uint64_t rollbacks;      // times the machine went back to redo frames
+    uint64_t resimulated;    // frames run again, resimulated / rollbacks is the average depth
+    uint64_t max_depth;
+    double resimulate_ms; // time spent going back and redoing frames
+    double max_resimulate_ms;
+};
+
+// two players on one keypad, each side of the session owning a copy of the machine. the keypad
+// of a frame is the local keys ORed with the remote player's. a frame whose remote keys haven't
+// arrived runs with a prediction (the last keys that did arrive), and the state before every
+// frame that isn't confirmed yet is kept. when the real keys arrive and differ, the machine goes
+// back to the first wrong frame and runs forward again with what is now known
+class RollbackSession
+{
+public:
+    // chip8 must already be in the same state on both sides (ROM, seed, frame length)
+    RollbackSession(Chip8 &chip8, uint32_t maxRollback = 8);
+
+    // runs the next frame with the local keys (bit k is key k), re-simulating first if remote
+    // keys have contradicted a prediction. false, running nothing, if the remote player is
+    // already maxRollback frames behind
+    bool AdvanceFrame(uint16_t localKeys);
+    // the remote keys for one frame. frames have to arrive in order, anything else is ignored
+    // (the sender repeats what hasn't been acknowledged)
+    void AddRemoteInput(uint64_t frame, uint16_t keys);
+    // redoes the frames a late input contradicted now rather than on the next AdvanceFrame
+    void Resimulate();
+
+    uint64_t Frame() const { return local_inputs.size(); }       // frames run
+    uint64_t ConfirmedFrame() const { return remote_inputs.size(); } // remote keys known before this
+    uint16_t LocalInput(uint64_t frame) const { return local_inputs[frame]; }
+    RollbackStats GetStats() const { return stats; }
+
+private:
+    Chip8 &chip8;
+    uint32_t max_rollback;
+    std::vector<uint16_t> local_inputs;  // one per frame run
+    std::vector<uint16_t> remote_inputs; // one per frame confirmed
+    uint64_t resimulate_from = UINT64_MAX; // the first frame run with a wrong prediction
+
+    // the state before each unconfirmed frame and the remote keys it was run with, indexed by
+    // frame modulo max_rollback + 1
+    std::unique_ptr<Chip8Snapshot[]> snapshots;
+    std::unique_ptr<uint16_t[]> used_remote;
+    RollbackStats stats{};
+
+    uint16_t RemoteInput(uint64_t frame) const;
+    void RunFrame(uint64_t frame);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "runahead.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// every early exit just resumes the frame, the host only cares about whole frames here
+static void RunWholeFrame(Chip8 &chip8)
+{
+    while (!chip8.RunFrame().frame_complete)
+    {
+    }
+}
+
+RunAhead::RunAhead(uint32_t frames) : frames(frames), snapshot(std::make_unique<Chip8Snapshot>())
+{
+}
+
+void RunAhead::RunFrame(Chip8 &chip8)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    RunWholeFrame(chip8);
+    if (frames == 0)
+    {
+        memcpy(video, chip8.GetVideo(), sizeof(video));
+    }
+    else
+    {
+        // the frames ahead only write the memory they touch, so the restore only copies that back
+        chip8.SaveState(*snapshot);
+        for (uint32_t frame = 0; frame < frames; frame++)
+        {
+            RunWholeFrame(chip8);
+        }
+        memcpy(video, chip8.GetVideo(), sizeof(video));
+        chip8.LoadState(*snapshot);
+    }
+
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    stats.frames++;
+    stats.total_ms += ms;
+    stats.max_ms = std::max(stats.max_ms, ms);
+    stats.over_budget += ms > FRAME_BUDGET_MS;
+}
+
+void RunAhead::Show(Chip8 const &chip8)
+{
+    memcpy(video, chip8.GetVideo(), sizeof(video));
+}
+
+// the screen ahead isn't the machine's, so the machine's dirty box says nothing about it. the
+// changed rows are found by comparing with what was taken last, 32 words at most
+bool RunAhead::TakeDirtyRect(DirtyRect &rect)
+{
+    int top = 0;
+    int bottom = 31;
+    if (!show_all)
+    {
+        while (top < 32 && video[top] == shown[top])
+        {
+            top++;
+        }
+        if (top == 32)
+        {
+            return false;
+        }
+        while (video[bottom] == shown[bottom])
+        {
+            bottom--;
+        }
+    }
+
+    rect = {0, top, 64, bottom - top + 1};
+    memcpy(&shown[top], &video[top], (bottom - top + 1) * sizeof(uint64_t));
+    show_all = false;
+    return true;
+}
+
+FrameTimeStats RunAhead::TakeFrameStats()
+{
+    FrameTimeStats taken = stats;
+    stats = {};
+    return taken;
+}
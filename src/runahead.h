@@ -0,0 +1,51 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <cstdint>
+#include <memory>
+#include "chip8.h"
+
+// how long the emulation of a frame took, run-ahead included, against the 60 Hz frame
+struct FrameTimeStats
+{
+    uint64_t frames;
+    double total_ms;
+    double max_ms;
+    uint64_t over_budget; // frames that took longer than FRAME_BUDGET_MS on their own
+};
+
+const double FRAME_BUDGET_MS = 1000.0 / 60.0;
+
+// hides a ROM's own input lag. each frame runs for real, then the state is saved, 'frames' more
+// frames are run with the same keypad, their screen is kept to be shown, and the state is put
+// back. a ROM that reacts to a key a frame or two late is then shown reacting straight away
+class RunAhead
+{
+public:
+    explicit RunAhead(uint32_t frames = 1);
+
+    void SetFrames(uint32_t count) { frames = count; }
+    uint32_t GetFrames() const { return frames; }
+
+    // runs one frame of chip8, which is left after that frame, and the frames ahead of it
+    void RunFrame(Chip8 &chip8);
+    // shows chip8 as it is without running anything, for frames the host stepped itself
+    void Show(Chip8 const &chip8);
+
+    // the screen to present, 'frames' frames ahead of the machine
+    uint64_t const *GetVideo() const { return video; }
+    // the rows of GetVideo() that changed since the last call, like Chip8::TakeDirtyRect
+    bool TakeDirtyRect(DirtyRect &rect);
+    // the frame times since the last call
+    FrameTimeStats TakeFrameStats();
+
+private:
+    uint32_t frames;
+    std::unique_ptr<Chip8Snapshot> snapshot;
+    uint64_t video[32]{};
+    uint64_t shown[32]{};
+    bool show_all = true; // nothing has been taken yet
+    FrameTimeStats stats{};
+};
+
+#endif
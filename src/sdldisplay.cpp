@@ -21,12 +21,61 @@ SDLDisplay::SDLDisplay(char const *title, int windowWidth, int windowHeight, int
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
 };
 
-void SDLDisplay::Update(void const *buffer, int pitch)
+// presents the packed screen (64 pixels a row, see expand.h), expanding only the dirty rows
+// straight into the locked texture. a nullptr dirty means nothing changed, so unless the
+// window needs redrawing the frame is skipped
+void SDLDisplay::UpdatePacked(uint64_t const *rows, SDL_Rect const *dirty)
 {
-    SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+    SDL_Rect lines{0, 0, 64, 32};
+    if (!expand_all && dirty)
+    {
+        lines.y = dirty->y;
+        lines.h = dirty->h;
+    }
+    else if (!expand_all && !redraw)
+    {
+        ++skipped_uploads;
+        return;
+    }
+
+    if (expand_all || dirty)
+    {
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(texture, &lines, &pixels, &pitch) == 0)
+        {
+            ExpandRows(kernel, rows + lines.y, lines.h, pixels, pitch, palette);
+            SDL_UnlockTexture(texture);
+            expand_all = false;
+        }
+    }
+
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
     SDL_RenderPresent(renderer);
+    redraw = false;
+}
+
+void SDLDisplay::SetPalette(Palette colours)
+{
+    palette = colours;
+    expand_all = true;
+}
+
+// page up presses minus page down presses since the last call
+int SDLDisplay::TakeRunAheadSteps()
+{
+    int steps = run_ahead_steps;
+    run_ahead_steps = 0;
+    return steps;
+}
+
+// frames UpdatePacked() skipped since the last call
+int SDLDisplay::TakeSkippedUploads()
+{
+    int skipped = skipped_uploads;
+    skipped_uploads = 0;
+    return skipped;
 }
 
 bool SDLDisplay::ProcessInput(uint8_t *keys)
@@ -37,226 +86,282 @@ bool SDLDisplay::ProcessInput(uint8_t *keys)
 
     while (SDL_PollEvent(&event))
     {
-        switch (event.type)
+        quit |= HandleEvent(event, keys);
+    }
+
+    return quit;
+}
+
+// blocks until an event arrives or timeoutMs passes, then handles everything queued
+bool SDLDisplay::WaitInput(uint8_t *keys, int timeoutMs)
+{
+    bool quit = false;
+
+    SDL_Event event;
+
+    if (SDL_WaitEventTimeout(&event, timeoutMs))
+    {
+        quit = HandleEvent(event, keys);
+    }
+
+    return ProcessInput(keys) || quit;
+}
+
+// updates keys for a key event, returns true if the event asks to quit
+bool SDLDisplay::HandleEvent(SDL_Event const &event, uint8_t *keys)
+{
+    bool quit = false;
+
+    switch (event.type)
+    {
+    case SDL_QUIT:
+    {
+        quit = true;
+    }
+    break;
+
+    case SDL_WINDOWEVENT:
+    {
+        // resized, exposed and the like, the old picture may be gone
+        redraw = true;
+    }
+    break;
+
+    case SDL_KEYDOWN:
+    {
+        switch (event.key.keysym.sym)
         {
-        case SDL_QUIT:
+        case SDLK_ESCAPE:
         {
             quit = true;
         }
         break;
 
-        case SDL_KEYDOWN:
-        {
-            switch (event.key.keysym.sym)
-            {
-            case SDLK_ESCAPE:
-            {
-                quit = true;
-            }
-            break;
-
-            case SDLK_x:
-            {
-                keys[0] = 1;
-            }
-            break;
-
-            case SDLK_1:
-            {
-                keys[1] = 1;
-            }
-            break;
-
-            case SDLK_2:
-            {
-                keys[2] = 1;
-            }
-            break;
-
-            case SDLK_3:
-            {
-                keys[3] = 1;
-            }
-            break;
-
-            case SDLK_q:
-            {
-                keys[4] = 1;
-            }
-            break;
-
-            case SDLK_w:
-            {
-                keys[5] = 1;
-            }
-            break;
-
-            case SDLK_e:
-            {
-                keys[6] = 1;
-            }
-            break;
-
-            case SDLK_a:
-            {
-                keys[7] = 1;
-            }
-            break;
-
-            case SDLK_s:
-            {
-                keys[8] = 1;
-            }
-            break;
-
-            case SDLK_d:
-            {
-                keys[9] = 1;
-            }
-            break;
-
-            case SDLK_z:
-            {
-                keys[0xA] = 1;
-            }
-            break;
-
-            case SDLK_c:
-            {
-                keys[0xB] = 1;
-            }
-            break;
-
-            case SDLK_4:
-            {
-                keys[0xC] = 1;
-            }
-            break;
-
-            case SDLK_r:
-            {
-                keys[0xD] = 1;
-            }
-            break;
-
-            case SDLK_f:
-            {
-                keys[0xE] = 1;
-            }
-            break;
-
-            case SDLK_v:
-            {
-                keys[0xF] = 1;
-            }
-            break;
-            }
-        }
-        break;
-
-        case SDL_KEYUP:
-        {
-            switch (event.key.keysym.sym)
-            {
-            case SDLK_x:
-            {
-                keys[0] = 0;
-            }
-            break;
-
-            case SDLK_1:
-            {
-                keys[1] = 0;
-            }
-            break;
-
-            case SDLK_2:
-            {
-                keys[2] = 0;
-            }
-            break;
-
-            case SDLK_3:
-            {
-                keys[3] = 0;
-            }
-            break;
-
-            case SDLK_q:
-            {
-                keys[4] = 0;
-            }
-            break;
-
-            case SDLK_w:
-            {
-                keys[5] = 0;
-            }
-            break;
-
-            case SDLK_e:
-            {
-                keys[6] = 0;
-            }
-            break;
-
-            case SDLK_a:
-            {
-                keys[7] = 0;
-            }
-            break;
-
-            case SDLK_s:
-            {
-                keys[8] = 0;
-            }
-            break;
-
-            case SDLK_d:
-            {
-                keys[9] = 0;
-            }
-            break;
-
-            case SDLK_z:
-            {
-                keys[0xA] = 0;
-            }
-            break;
-
-            case SDLK_c:
-            {
-                keys[0xB] = 0;
-            }
-            break;
-
-            case SDLK_4:
-            {
-                keys[0xC] = 0;
-            }
-            break;
-
-            case SDLK_r:
-            {
-                keys[0xD] = 0;
-            }
-            break;
-
-            case SDLK_f:
-            {
-                keys[0xE] = 0;
-            }
-            break;
-
-            case SDLK_v:
-            {
-                keys[0xF] = 0;
-            }
-            break;
-            }
+        case SDLK_BACKSPACE:
+        {
+            rewinding = true;
+        }
+        break;
+
+        case SDLK_PAGEUP:
+        {
+            ++run_ahead_steps;
+        }
+        break;
+
+        case SDLK_PAGEDOWN:
+        {
+            --run_ahead_steps;
+        }
+        break;
+
+        case SDLK_x:
+        {
+            keys[0] = 1;
+        }
+        break;
+
+        case SDLK_1:
+        {
+            keys[1] = 1;
+        }
+        break;
+
+        case SDLK_2:
+        {
+            keys[2] = 1;
+        }
+        break;
+
+        case SDLK_3:
+        {
+            keys[3] = 1;
+        }
+        break;
+
+        case SDLK_q:
+        {
+            keys[4] = 1;
+        }
+        break;
+
+        case SDLK_w:
+        {
+            keys[5] = 1;
+        }
+        break;
+
+        case SDLK_e:
+        {
+            keys[6] = 1;
+        }
+        break;
+
+        case SDLK_a:
+        {
+            keys[7] = 1;
+        }
+        break;
+
+        case SDLK_s:
+        {
+            keys[8] = 1;
+        }
+        break;
+
+        case SDLK_d:
+        {
+            keys[9] = 1;
         }
         break;
+
+        case SDLK_z:
+        {
+            keys[0xA] = 1;
         }
+        break;
+
+        case SDLK_c:
+        {
+            keys[0xB] = 1;
+        }
+        break;
+
+        case SDLK_4:
+        {
+            keys[0xC] = 1;
+        }
+        break;
+
+        case SDLK_r:
+        {
+            keys[0xD] = 1;
+        }
+        break;
+
+        case SDLK_f:
+        {
+            keys[0xE] = 1;
+        }
+        break;
+
+        case SDLK_v:
+        {
+            keys[0xF] = 1;
+        }
+        break;
+        }
+    }
+    break;
+
+    case SDL_KEYUP:
+    {
+        switch (event.key.keysym.sym)
+        {
+        case SDLK_BACKSPACE:
+        {
+            rewinding = false;
+        }
+        break;
+
+        case SDLK_x:
+        {
+            keys[0] = 0;
+        }
+        break;
+
+        case SDLK_1:
+        {
+            keys[1] = 0;
+        }
+        break;
+
+        case SDLK_2:
+        {
+            keys[2] = 0;
+        }
+        break;
+
+        case SDLK_3:
+        {
+            keys[3] = 0;
+        }
+        break;
+
+        case SDLK_q:
+        {
+            keys[4] = 0;
+        }
+        break;
+
+        case SDLK_w:
+        {
+            keys[5] = 0;
+        }
+        break;
+
+        case SDLK_e:
+        {
+            keys[6] = 0;
+        }
+        break;
+
+        case SDLK_a:
+        {
+            keys[7] = 0;
+        }
+        break;
+
+        case SDLK_s:
+        {
+            keys[8] = 0;
+        }
+        break;
+
+        case SDLK_d:
+        {
+            keys[9] = 0;
+        }
+        break;
+
+        case SDLK_z:
+        {
+            keys[0xA] = 0;
+        }
+        break;
+
+        case SDLK_c:
+        {
+            keys[0xB] = 0;
+        }
+        break;
+
+        case SDLK_4:
+        {
+            keys[0xC] = 0;
+        }
+        break;
+
+        case SDLK_r:
+        {
+            keys[0xD] = 0;
+        }
+        break;
+
+        case SDLK_f:
+        {
+            keys[0xE] = 0;
+        }
+        break;
+
+        case SDLK_v:
+        {
+            keys[0xF] = 0;
+        }
+        break;
+        }
+    }
+    break;
     }
 
     return quit;
@@ -2,18 +2,33 @@
 #define SDLDISPLAY_H
 
 #include <SDL.h>
+#include "expand.h"
 
 class SDLDisplay
 {
 public:
     SDLDisplay(char const *title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
-    void Update(void const *buffer, int pitch);
+    void UpdatePacked(uint64_t const *rows, SDL_Rect const *dirty);
+    void SetPalette(Palette colours);
+    int TakeSkippedUploads();
     bool ProcessInput(uint8_t *keys);
+    bool WaitInput(uint8_t *keys, int timeoutMs);
+    bool IsRewinding() const { return rewinding; } // the rewind key (backspace) is held
+    int TakeRunAheadSteps();
 
 private:
+    bool HandleEvent(SDL_Event const &event, uint8_t *keys);
+
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+    bool redraw = true; // the window needs presenting even if the texture didn't change
+    bool expand_all = true; // UpdatePacked has to fill the whole texture, not just the dirty rows
+    Palette palette = DEFAULT_PALETTE;
+    ExpandKernel kernel = BestExpandKernel();
+    int skipped_uploads = 0;
+    bool rewinding = false;
+    int run_ahead_steps = 0;
 };
 
 #endif
\ No newline at end of file
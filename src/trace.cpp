@@ -0,0 +1,107 @@
+#include "trace.h"
+#include <cstring>
+
+TraceSink &TraceSink::Get()
+{
+    static TraceSink sink;
+    return sink;
+}
+
+TraceSink::~TraceSink()
+{
+    Flush();
+}
+
+void TraceSink::SetOutput(FILE *file)
+{
+    Flush();
+    output = file;
+}
+
+void TraceSink::Write(void const *data, size_t size)
+{
+    if (used + size > sizeof(buffer))
+    {
+        Flush();
+    }
+
+    // records are always small, but don't lose one that can't fit the buffer
+    if (size > sizeof(buffer))
+    {
+        fwrite(data, 1, size, output);
+        return;
+    }
+
+    memcpy(buffer + used, data, size);
+    used += size;
+}
+
+void TraceSink::Flush()
+{
+    if (used > 0)
+    {
+        fwrite(buffer, 1, used, output);
+        fflush(output);
+        used = 0;
+    }
+}
+
+// writes the lowest 'digits' nibbles of value as hex
+static char *PutHex(char *out, unsigned int value, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        *out++ = hex[(value >> (i * 4)) & 0xFu];
+    }
+    return out;
+}
+
+static char *PutString(char *out, char const *text)
+{
+    while (*text)
+    {
+        *out++ = *text++;
+    }
+    return out;
+}
+
+void TraceText(TraceEvent event, uint16_t pc, uint16_t a, uint16_t b)
+{
+    char line[64];
+    char *out = PutHex(line, pc, 3);
+    *out++ = ' ';
+
+    switch (event)
+    {
+    case TraceEvent::Opcode:
+        out = PutHex(out, a, 4);
+        break;
+
+    case TraceEvent::DisplayCleared:
+        out = PutString(out, "display cleared");
+        break;
+
+    case TraceEvent::SetRegister:
+        out = PutString(out, "set register");
+        out = PutHex(out, a, 1);
+        out = PutString(out, " = ");
+        out = PutHex(out, b, 2);
+        break;
+
+    case TraceEvent::AddRegister:
+        out = PutString(out, "add register");
+        out = PutHex(out, a, 1);
+        out = PutString(out, " = ");
+        out = PutHex(out, b, 2);
+        break;
+
+    case TraceEvent::SetIndex:
+        out = PutString(out, "set index register I = ");
+        out = PutHex(out, a, 3);
+        break;
+    }
+
+    *out++ = '\n';
+    TraceSink::Get().Write(line, out - line);
+}
@@ -0,0 +1,84 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+// trace level is picked at compile time, e.g. make TRACE=1
+// 0 = off (every Trace call compiles to nothing), 1 = text records, 2 = binary records
+#ifndef CHIP8_TRACE_LEVEL
+#define CHIP8_TRACE_LEVEL 0
+#endif
+
+enum class TraceLevel
+{
+    Off = 0,
+    Text = 1,
+    Binary = 2
+};
+
+constexpr TraceLevel TRACE_LEVEL = static_cast<TraceLevel>(CHIP8_TRACE_LEVEL);
+
+enum class TraceEvent : uint8_t
+{
+    Opcode,         // a = opcode
+    DisplayCleared, //
+    SetRegister,    // a = register number, b = new value
+    AddRegister,    // a = register number, b = new value
+    SetIndex        // a = new index
+};
+
+// fixed size record written at TraceLevel::Binary
+struct TraceRecord
+{
+    uint8_t event;
+    uint8_t reserved;
+    uint16_t pc;
+    uint16_t a;
+    uint16_t b;
+};
+
+// collects trace output in a fixed buffer and only hands it to stdio when the buffer
+// is full or on Flush(), so tracing never costs a syscall per instruction
+class TraceSink
+{
+public:
+    static TraceSink &Get();
+    ~TraceSink();
+
+    void SetOutput(FILE *file);
+    void Write(void const *data, size_t size);
+    void Flush();
+
+private:
+    TraceSink() = default;
+
+    FILE *output = stdout;
+    size_t used = 0;
+    char buffer[64 * 1024];
+};
+
+void TraceText(TraceEvent event, uint16_t pc, uint16_t a, uint16_t b);
+
+inline void Trace(TraceEvent event, uint16_t pc, uint16_t a = 0, uint16_t b = 0)
+{
+    if constexpr (TRACE_LEVEL == TraceLevel::Text)
+    {
+        TraceText(event, pc, a, b);
+    }
+    else if constexpr (TRACE_LEVEL == TraceLevel::Binary)
+    {
+        TraceRecord record{static_cast<uint8_t>(event), 0, pc, a, b};
+        TraceSink::Get().Write(&record, sizeof(record));
+    }
+    else
+    {
+        (void)event;
+        (void)pc;
+        (void)a;
+        (void)b;
+    }
+}
+
+#endif